@@ -0,0 +1,87 @@
+﻿#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "FreeSpaceMap.h"
+#include "Journal.h"
+#include "Storage.h"
+
+namespace TestTask {
+
+	// Таблица связей кластеров (VFSTable), целиком загруженная в память.
+	// Один экземпляр на VFS, разделяется всеми File этой VFS.
+	// Изменения сразу же записываются в VFSTable (write-through), но сначала - одной записью в журнал (VFSJournal):
+	// на диск синхронно сбрасывается только журнал, а VFSTable - на контрольных точках. Выделение при дописывании
+	// в существующую цепочку журнал на диск не сбрасывает - иначе каждая мелкая запись в файл ждала бы fdatasync; его надежность
+	// наступает на Sync, Close или контрольной точке (не позже journalCheckpointInterval). Если после сбоя питания
+	// ссылка на новый участок оказалась на диске без ссылок самого участка, цепочку обрывает recover.
+	// Поиск по таблице идет под разделяемой блокировкой, поэтому читатели не мешают друг другу;
+	// выделение кластеров сериализуется отдельной блокировкой и не останавливает читателей.
+	class ClusterTable {
+	public:
+		ClusterTable(std::filesystem::path VFSPath_, StorageBackend backend); // таблицу загружает владелец через reload
+
+		// применение журнала, оставшегося после сбоя, и загрузка таблицы (VFSTable заблокирована для других процессов);
+		// summary - сводка карты с чистого отключения, если она еще верна; repair - VFS отключили не чисто и больше никем не подключена:
+		// проверить цепочки и построить карту по таблице
+		void recover(const FreeSpaceSummary* summary, bool repair);
+
+		void reload(const FreeSpaceSummary* summary = nullptr); // чтение VFSTable и карты свободных кластеров с диска (например, после изменений другим процессом)
+
+		int64_t getNext(size_t clusterNumber); // следующий кластер (или метка из VFSTable)
+
+		std::vector<Extent> allocateChain(int64_t tail, size_t count); // выделение count кластеров в конец цепочки tail
+
+		Extent getRun(size_t from, size_t maxLength); // участок цепочки из идущих подряд кластеров
+
+		size_t chainLength(size_t first); // количество кластеров в цепочке, начиная с first
+
+		std::vector<Extent> chainRuns(size_t first); // цепочка, разбитая на непрерывные участки
+
+		Extent reserveRun(size_t count, size_t limit); // непрерывный участок до limit, пока ни с чем не связанный; length = 0, если нет
+
+		void linkRun(Extent run); // связать участок в отдельную цепочку
+
+		void freeRuns(const std::vector<Extent>& runs); // освобождение участков одной записью журнала
+
+		size_t truncateChain(size_t first, size_t keep); // цепочка укорачивается до keep кластеров, возвращает количество освобожденных
+
+		size_t trimFreeTail(); // отрезание свободных кластеров в конце VFSTable, возвращает оставшееся количество кластеров
+
+		size_t size();
+
+		void flush(); // сделать записанное в VFSTable видимым другим процессам
+
+		void sync(); // сброс журнала, VFSTable и карты на диск
+
+		void checkpoint(); // сброс VFSTable и карты на диск и очистка журнала (VFSTable заблокирована для других процессов)
+
+		size_t journalSize() { return journal.size(); }
+
+		FreeSpaceSummary freeSpaceSummary();
+
+	private:
+		void writeLinks(size_t first, size_t count); // запись участка VFSTable из links
+
+		void repairChains(); // обрывание цепочек перед пустыми кластерами (allocation и access взяты)
+
+		std::vector<Extent> collectRuns(int64_t cluster); // участки цепочки от cluster до конца (access взята)
+
+		void unlinkRuns(const std::vector<Extent>& runs, const std::vector<LinkUpdate>& updates); // освобождение участков и другие ссылки одной записью журнала (allocation взята)
+
+		std::unique_ptr<IStorage> VFSTable;
+
+		std::vector<int64_t> links; // links[i] - номер кластера, следующего за i-м
+
+		FreeSpaceMap freeSpace;
+
+		Journal journal;
+
+		std::shared_mutex access; // защищает links
+
+		std::mutex allocation; // защищает freeSpace, берется раньше access
+	};
+}
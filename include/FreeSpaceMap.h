@@ -0,0 +1,69 @@
+﻿#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace TestTask {
+
+	struct Extent { // непрерывный участок кластеров
+		size_t first = 0;
+		size_t length = 0;
+	};
+
+	struct FreeSpaceSummary { // то, что иначе пришлось бы считать проходом по всей карте
+		size_t freeClusters = 0;
+		size_t searchHint = 0;
+	};
+
+	// Битовая карта свободных кластеров (VFSBitmap). Бит i равен 1, если i-й кластер занят.
+	// Хранится рядом с VFSTable; изменения сразу же записываются на диск.
+	// Синхронизация - на стороне владельца (ClusterTable).
+	class FreeSpaceMap {
+	public:
+		FreeSpaceMap(std::filesystem::path VFSPath_);
+
+		~FreeSpaceMap();
+
+		bool load(size_t clusterCount_, const FreeSpaceSummary* summary); // false, если карта на диске не соответствует таблице; summary - готовые счетчики
+
+		void rebuild(const std::vector<int64_t>& links); // построение карты по VFSTable
+
+		std::vector<Extent> allocate(size_t count); // выделение count кластеров, по возможности непрерывными участками
+
+		Extent allocateRun(size_t count, size_t limit); // один непрерывный участок, целиком до limit; length = 0, если такого нет
+
+		void reserve(size_t first, size_t length); // пометка участка как занятого
+
+		void release(size_t first, size_t length);
+
+		size_t clusterCount() { return clusters; }
+
+		size_t freeClusters() { return freeCount; }
+
+		FreeSpaceSummary summary() { return FreeSpaceSummary{ freeCount, searchHint }; }
+
+		bool isUsed(size_t clusterNumber);
+
+		void truncate(size_t clusterCount_); // отрезание свободного хвоста карты
+
+		void sync(); // сброс карты на диск
+
+	private:
+		void setRange(size_t first, size_t length, bool used);
+
+		void writeRange(size_t first, size_t length); // запись байтов карты, покрывающих участок
+
+		std::filesystem::path bitmapPath;
+
+		std::fstream VFSBitmap;
+
+		std::vector<uint8_t> bits;
+
+		size_t clusters = 0; // количество кластеров, описываемых картой
+
+		size_t freeCount = 0;
+
+		size_t searchHint = 0; // все кластеры до searchHint заняты
+	};
+}
@@ -0,0 +1,110 @@
+﻿#pragma once
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace TestTask {
+
+	// Пул потоков для асинхронных операций. У каждого потока своя очередь: задачи с одним ключом (одним File)
+	// всегда попадают в одну очередь и выполняются по порядку, задачи разных File - параллельно.
+	class IOEngine {
+	public:
+		IOEngine(size_t threadCount); // 0 - по количеству ядер
+
+		~IOEngine(); // дожидается уже поставленных задач
+
+		IOEngine(const IOEngine&) = delete;
+
+		IOEngine& operator=(const IOEngine&) = delete;
+
+		void submit(const void* key, std::function<void()> task);
+
+		template <class Task>
+		auto submitFuture(const void* key, Task task) -> std::future<decltype(task())> {
+			auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+			std::future<decltype(task())> result = packaged->get_future();
+			submit(key, [packaged]() { (*packaged)(); });
+			return result;
+		}
+
+		size_t threadCount() { return queues.size(); }
+
+		bool runsQueueOf(const void* key); // вызывающий поток - тот, что выполняет задачи с ключом key
+
+
+	private:
+		struct Queue {
+			std::mutex access;
+
+			std::condition_variable ready;
+
+			std::deque<std::function<void()>> tasks;
+
+			bool stopping = false;
+		};
+
+		void work(Queue& queue);
+
+		size_t queueIndex(const void* key) { return std::hash<const void*>()(key) % queues.size(); }
+
+		std::vector<std::unique_ptr<Queue>> queues;
+
+		std::vector<std::thread> workers;
+	};
+
+	// Ожидаемая операция для co_await: корутина приостанавливается, операция ставится в очередь IOEngine,
+	// а корутина продолжается в потоке пула сразу после завершения операции
+	template <class Result>
+	class IOAwaitable {
+	public:
+		IOAwaitable(IOEngine& engine_, const void* key_, std::function<Result()> operation_)
+			: engine(engine_), key(key_), operation(std::move(operation_)) {}
+
+		bool await_ready() { return false; }
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			engine.submit(key, [this, handle]() {
+				try {
+					if constexpr (std::is_void_v<Result>) {
+						operation();
+					}
+					else {
+						result = operation();
+					}
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+				handle.resume();
+			});
+		}
+
+		Result await_resume() {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			if constexpr (!std::is_void_v<Result>) {
+				return std::move(result);
+			}
+		}
+
+	private:
+		IOEngine& engine;
+
+		const void* key;
+
+		std::function<Result()> operation;
+
+		std::conditional_t<std::is_void_v<Result>, char, Result> result{};
+
+		std::exception_ptr error;
+	};
+}
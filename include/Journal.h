@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+namespace TestTask {
+
+	inline const char journalRecordMagic[4] = { 'T', 'V', 'J', 'R' };
+	inline const size_t journalRecordHeaderSize = 8; // magic и количество изменений (int32)
+	inline const size_t journalUpdateSize = 16; // номер кластера (int64) и новая ссылка (int64)
+	inline const size_t journalChecksumSize = 4;
+	inline const size_t journalCheckpointSize = size_t(1) << 20; // журнал больше этого - пора контрольной точки
+	inline const std::chrono::milliseconds journalCheckpointInterval(1000); // и не реже, чем раз в столько
+
+	struct LinkUpdate { // новое значение одной ссылки VFSTable
+		size_t cluster = 0;
+		int64_t next = 0;
+	};
+
+	// Журнал упреждающей записи для VFSTable (VFSJournal). Все ссылки одного изменения таблицы дописываются
+	// сюда одной записью; commit сбрасывает ее на диск fdatasync, в VFSTable ссылки пишутся уже без ожидания диска.
+	// Выделения при дописывании файлов идут через append: их надежность отложена до Sync, Close или контрольной точки.
+	// При подключении VFS целые записи применяются к VFSTable заново (значения ссылок абсолютные - повтор безвреден),
+	// оборванная запись в конце отбрасывается. Журнал очищается на контрольной точке, когда VFSTable сброшена на диск.
+	// Синхронизация между процессами - на стороне владельца: дописывают и очищают журнал под блокировкой VFSTable.
+	class Journal {
+	public:
+		Journal(const std::filesystem::path& path);
+
+		~Journal();
+
+		Journal(const Journal&) = delete;
+
+		Journal& operator=(const Journal&) = delete;
+
+		void commit(const std::vector<LinkUpdate>& updates); // возвращается, когда запись уже на диске
+
+		void append(const std::vector<LinkUpdate>& updates); // то же без fdatasync: запись дойдет до диска вместе со следующей
+
+		void sync(); // сброс на диск записей, дописанных через append
+
+		std::vector<LinkUpdate> replay(); // изменения из всех целых записей по порядку
+
+		size_t size();
+
+		void reset(); // очистка после контрольной точки
+
+	private:
+		int fd = -1;
+
+		std::mutex access;
+	};
+}
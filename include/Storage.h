@@ -0,0 +1,214 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace TestTask {
+
+	enum class StorageBackend : char { // способ доступа к файлам VFS
+		Stream, // std::fstream
+		Mapped // отображение файла в память (mmap)
+	};
+
+	// Файл VFS, к которому обращаются по смещениям
+	struct IStorage {
+		virtual ~IStorage() = default;
+		virtual size_t read(size_t offset, char* buff, size_t len) = 0; // возвращает количество реально прочитанных байт
+		virtual void write(size_t offset, const char* buff, size_t len) = 0;
+		virtual void flush() = 0; // сделать записанное видимым для других дескрипторов файла
+		virtual void publish() { flush(); } // то же без отсрочек: на записанное сейчас сошлются длина файла или VFSTable
+		virtual void sync() = 0; // сбросить записанное на диск
+		virtual size_t size() = 0;
+		virtual void truncate(size_t newSize) = 0; // укорачивание файла (его не должны держать открытым другие процессы)
+		virtual std::string_view view(size_t, size_t) { return {}; } // данные без копирования, если хранилище это умеет
+		virtual bool canView() { return false; }
+		virtual void invalidate() {} // забыть закэшированные данные - их мог изменить другой процесс
+		virtual void prefetch(size_t, size_t) {} // подкачать участок заранее - скоро его прочитают
+	};
+
+	class StreamStorage : public IStorage {
+	public:
+		StreamStorage(const std::filesystem::path& path);
+
+		virtual size_t read(size_t offset, char* buff, size_t len) final;
+		virtual void write(size_t offset, const char* buff, size_t len) final;
+		virtual void flush() final;
+		virtual void sync() final;
+		virtual size_t size() final;
+		virtual void truncate(size_t newSize) final;
+
+	private:
+		std::filesystem::path path;
+
+		std::fstream stream;
+
+		std::mutex access; // у потока одна позиция чтения/записи на всех
+	};
+
+#if defined(__unix__) || defined(__APPLE__)
+	inline const size_t mappedChunkSize = size_t(64) << 20; // отображение растет участками по 64 МиБ
+
+	// Файл, отображенный в память. Под отображение заранее резервируется диапазон адресов,
+	// поэтому при росте файла отображение не перемещается и указатели на данные остаются верными.
+	// Файл, размер которого ничего не значит, растет с запасом участками mappedChunkSize:
+	// запись внутри запаса обходится без системных вызовов, а конец данных хранится в памяти.
+	class MappedStorage : public IStorage {
+	public:
+		MappedStorage(const std::filesystem::path& path, bool chunkedGrowth_);
+
+		~MappedStorage();
+
+		virtual size_t read(size_t offset, char* buff, size_t len) final;
+		virtual void write(size_t offset, const char* buff, size_t len) final;
+		virtual void flush() final {} // отображение общее для всех процессов - запись видна сразу
+		virtual void sync() final;
+		virtual size_t size() final;
+		virtual void truncate(size_t newSize) final; // отображение остается: за концом файла к нему не обращаются
+		virtual std::string_view view(size_t offset, size_t len) final;
+		virtual bool canView() final { return true; }
+		virtual void prefetch(size_t offset, size_t len) final;
+
+	private:
+		void reserve(size_t newSize); // расширение файла (если запаса не хватает) и отображения
+
+		void refresh(); // подхват роста файла, сделанного другим процессом
+
+		void mapUpTo(size_t newSize); // отображение файла хотя бы до newSize байт (growth заблокирован)
+
+		int fd = -1;
+
+		char* base = nullptr; // начало зарезервированного диапазона адресов
+
+		size_t reservedSize = 0;
+
+		size_t mappedSize = 0; // сколько байт диапазона отображено на файл
+
+		std::atomic<size_t> fileSize{ 0 }; // конец данных
+
+		size_t fileCapacity = 0; // размер самого файла (не меньше fileSize); защищен growth
+
+		bool chunkedGrowth = false; // false - файл растет ровно до fileSize: по размеру файла другие процессы считают записи в нем
+
+		std::mutex growth;
+	};
+#endif
+
+	inline const size_t cachePageSize = 4096; // размер страницы кэша
+	inline const size_t defaultCacheSize = size_t(16) << 20; // бюджет кэша по умолчанию
+	inline const size_t cacheBypassPages = 16; // операции длиннее стольких страниц идут мимо кэша
+	inline const std::chrono::milliseconds cacheFlushInterval(1000); // грязные страницы не лежат в кэше дольше
+
+	// Кэш страниц с отложенной записью поверх другого хранилища (LRU, ограничен по объему).
+	// Мелкие записи копятся в памяти; грязные страницы пишутся на диск по порядку смещений,
+	// соседние - одной записью: при sync, при вытеснении, при превышении порога грязных данных
+	// или по времени (проверяется в flush). Другие процессы видят данные только после записи на диск,
+	// поэтому перед тем, как сослаться на них, их пишут сразу (publish).
+	class CachedStorage : public IStorage {
+	public:
+		CachedStorage(std::unique_ptr<IStorage> inner_, size_t budget_);
+
+		~CachedStorage();
+
+		virtual size_t read(size_t offset, char* buff, size_t len) final;
+		virtual void write(size_t offset, const char* buff, size_t len) final;
+		virtual void flush() final; // запись грязных страниц, если достигнут порог по объему или времени
+		virtual void publish() final; // запись всех грязных страниц сразу (без сброса на диск)
+		virtual void sync() final;
+		virtual size_t size() final;
+		virtual void truncate(size_t newSize) final;
+		virtual std::string_view view(size_t offset, size_t len) final;
+		virtual bool canView() final { return inner->canView(); }
+		virtual void invalidate() final;
+		virtual void prefetch(size_t offset, size_t len) final;
+
+	private:
+		struct Page {
+			std::vector<char> data;
+
+			size_t dirtyFrom = 0; // грязный участок страницы [dirtyFrom, dirtyTo)
+
+			size_t dirtyTo = 0;
+
+			std::list<size_t>::iterator lruPosition;
+		};
+
+		Page& getPage(size_t pageNumber, bool load); // страница из кэша (с вытеснением старых при нехватке места)
+
+		void writeBack(); // запись всех грязных страниц (access заблокирован)
+
+		void writeBackRange(size_t offset, size_t len); // запись грязных страниц, пересекающих участок
+
+		void evict();
+
+		std::unique_ptr<IStorage> inner;
+
+		size_t budget; // сколько страниц может лежать в кэше
+
+		std::unordered_map<size_t, Page> pages;
+
+		std::list<size_t> lru; // номера страниц, в начале - недавно использованные
+
+		size_t dirtyPages = 0;
+
+		size_t cachedEnd = 0; // конец данных с учетом еще не записанных на диск
+
+		std::chrono::steady_clock::time_point oldestDirty; // когда появилась первая из еще не записанных страниц
+
+		std::mutex access;
+	};
+
+	// Блокировка участка файла, видимая другим процессам (fcntl). Участок может лежать где угодно в файле -
+	// данные файла она не защищает, это лишь общее для процессов имя. Потоки одного процесса
+	// ею друг от друга не отделяются, для них нужны обычные мьютексы.
+	class ProcessLock {
+	public:
+		ProcessLock(const std::filesystem::path& path);
+
+		~ProcessLock();
+
+		ProcessLock(const ProcessLock&) = delete;
+
+		ProcessLock& operator=(const ProcessLock&) = delete;
+
+		void lock(size_t offset, size_t length, bool exclusive);
+
+		bool tryLock(size_t offset, size_t length, bool exclusive); // без ожидания: false, если участок занят другим процессом
+
+		void unlock(size_t offset, size_t length);
+
+	private:
+		int fd = -1;
+	};
+
+	class ProcessLockGuard {
+	public:
+		ProcessLockGuard(ProcessLock& lock_, size_t offset_, size_t length_, bool exclusive) : lock(lock_), offset(offset_), length(length_) {
+			lock.lock(offset, length, exclusive);
+		}
+
+		~ProcessLockGuard() { lock.unlock(offset, length); }
+
+		ProcessLockGuard(const ProcessLockGuard&) = delete;
+
+		ProcessLockGuard& operator=(const ProcessLockGuard&) = delete;
+
+	private:
+		ProcessLock& lock;
+
+		size_t offset;
+
+		size_t length;
+	};
+
+	void syncFile(const std::filesystem::path& path); // сброс файла на диск по пути - для fstream, у которого нет дескриптора
+
+	// cacheSize - бюджет кэша в байтах; chunkedGrowth - файл может быть длиннее данных (VFSData: кластеры считает VFSTable)
+	std::unique_ptr<IStorage> openStorage(const std::filesystem::path& path, StorageBackend backend, size_t cacheSize = 0, bool chunkedGrowth = false);
+}
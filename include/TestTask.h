@@ -3,6 +3,12 @@
 #include <filesystem>
 #include <mutex>
 #include <fstream>
+#include <memory>
+#include <vector>
+#include "ClusterTable.h"
+#include "Storage.h"
+#include "VFSFormat.h"
+#include "VFSMount.h"
 
 namespace TestTask {
 
@@ -10,6 +16,8 @@ namespace TestTask {
 	inline const std::string VFSHeaderFileName("VFSHeader" + VFSFileFormat);
 	inline const std::string VFSTableFileName("VFSTable" + VFSFileFormat);
 	inline const std::string VFSDataFileName("VFSData" + VFSFileFormat);
+	inline const std::string VFSBitmapFileName("VFSBitmap" + VFSFileFormat);
+	inline const std::string VFSJournalFileName("VFSJournal" + VFSFileFormat);
 
 	inline const std::string clusterSizeMark("ClusterSize =");
 	inline const std::string firstEmptyClusterMark("FirstEmptyCluster =");
@@ -25,6 +33,13 @@ namespace TestTask {
 	inline const int maxThreadsCount = 20; // максимальное количество потоков на один файл
 	inline const int maxThreadsCounterLength = 2; // количество цифр в maxThreadsCount
 	inline const int defaultClusterSize = 10; // количество символов на один кластер
+	inline const size_t pageClusterSize = 4096; // рекомендуемый размер кластера: одна страница памяти
+	inline const size_t largeClusterSize = 65536; // рекомендуемый размер кластера для больших файлов
+	inline const size_t maxClusterSize = size_t(1) << 30; // максимальный размер кластера
+	inline const size_t readAheadMinClusters = 4; // начальное окно упреждающего чтения
+	inline const size_t readAheadMaxClusters = 1024;
+	inline const size_t readAheadMaxBytes = size_t(4) << 20; // окно не растет дальше стольких байт
+	inline const size_t zeroFillChunkSize = size_t(1) << 20; // Truncate дописывает нули кусками не больше этого
 
 	// метки для VFSTable
 	inline const int clusterIsEmpty = -1; // метка пустого кластера
@@ -32,28 +47,54 @@ namespace TestTask {
 	inline const int faultyCluster = -3; // метка кластера с ошибкой 
 	inline const int didNotFindCluster = -4; // ошибка при поиске кластера
 
-	static std::mutex VFSTableAccess;
-	static std::mutex VFSHeaderAccess;
-
 	enum class FileStatus : char {
 		ReadOnly,WriteOnly,Closed,EndOfFile,Bad
 	};
 
+	enum class SeekOrigin : char { // откуда отсчитывается смещение в Seek
+		Begin,Current,End
+	};
+
+	struct IOBuffer { // один буфер из набора для ReadV/WriteV
+		char* data = nullptr;
+		size_t length = 0;
+	};
+
 	class File {
 	public:
-		std::fstream VFSHeader;
+		std::shared_ptr<VFSMount> mount; // VFS, в которой лежит файл
 
-		std::fstream VFSTable;
-
-		std::fstream VFSData;
+		std::vector<char> viewBuffer; // копия данных для ReadView, если VFSData не отображен в память
 
 		size_t indicatorPosition = 0; // позиция курсора в текущем кластере
 
 		size_t currentCluster = 0; // номер текущего кластера
 
-		File(std::filesystem::path VFSpath_, std::string filePath_, FileStatus status_);
+		size_t clusterIndex = 0; // порядковый номер текущего кластера в цепочке файла
+
+		size_t snapshotClusters = SIZE_MAX; // читателю видны только кластеры, которые были в цепочке при открытии
+
+		size_t readAheadWindow = 0; // окно упреждающего чтения в кластерах; растет, пока File читают подряд
+
+		size_t prefetchedUntil = 0; // кластеры цепочки с меньшими порядковыми номерами уже подкачаны
+
+		size_t lastReadEnd = 0; // где закончилось прошлое чтение: только чтение с этой позиции идет подряд и подкачивает кластеры вперед
 
-		~File();
+		size_t fileLength = 0; // длина файла для читателя - на момент открытия
+
+		bool inlined = false; // у файла нет кластеров: данные лежат в его записи в VFSHeader, курсор - indicatorPosition
+
+		std::vector<char> inlineData; // данные такого файла для читателя - на момент открытия
+
+		std::vector<size_t> chainIndex; // порядковый номер кластера в цепочке -> номер кластера в VFSData; строится при первом Seek
+
+		std::mutex indexAccess; // защищает chainIndex: PRead и PWrite идут мимо cursorAccess
+
+		std::mutex* fileAccess = nullptr; // блокировка писателей файла; читатели ее не берут
+
+		std::mutex cursorAccess; // защищает позицию этого File, если им пользуются несколько потоков
+
+		File(std::shared_ptr<VFSMount> mount_, std::string filePath_, FileStatus status_);
 
 		operator bool();
 
@@ -61,7 +102,9 @@ namespace TestTask {
 
 		size_t getClusterSize() { return clusterSize; }
 
-		void finInit(int clusterSize_, int firstCluster_);
+		size_t getRecordNumber() { return recordNumber; }
+
+		void finInit(size_t clusterSize_, int64_t firstCluster_, size_t recordNumber_);
 
 		FileStatus getStatus() { return status; }
 
@@ -71,22 +114,25 @@ namespace TestTask {
 
 		void setEOFStatus() { status = FileStatus::EndOfFile; }
 
+		void resetEOFStatus() { if (status == FileStatus::EndOfFile) status = FileStatus::ReadOnly; } // после Seek читать можно снова
+
 		size_t getFirstCluster() { return firstCluster; }
 
 	private:
 		FileStatus status = FileStatus::Closed;
 
-		//std::filesystem::path VFSPath; // путь к директории с VFS
 		std::string filePath; // "фиктивный" путь к файлу
 
 		size_t firstCluster = 0; // номер первого кластера данного файла
 
 		size_t clusterSize = 0;
+
+		size_t recordNumber = 0; // номер записи о файле в VFSHeader
 	};
 
 	struct IVFS {
-		virtual File* Open(const char* name) = 0; // Открыть файл в readonly режиме. Если нет такого файла или же он открыт во writeonly режиме - вернуть nullptr
-		virtual File* Create(const char* name) = 0; // Открыть или создать файл в writeonly режиме. Если нужно, то создать все нужные поддиректории, упомянутые в пути. Вернуть nullptr, если этот файл уже открыт в readonly режиме.
+		virtual File* Open(const char* name) = 0; // Открыть файл в readonly режиме. Если нет такого файла - вернуть nullptr. Открытый во writeonly режиме файл читается в том виде, в каком был при открытии
+		virtual File* Create(const char* name) = 0; // Открыть или создать файл в writeonly режиме. Если нужно, то создать все нужные поддиректории, упомянутые в пути. Файл, открытый в readonly режиме, тоже можно открыть - его читатели не увидят новых данных.
 		virtual size_t Read(File* f, char* buff, size_t len) = 0; // Прочитать данные из файла. Возвращаемое значение - сколько реально байт удалось прочитать
 		virtual size_t Write(File* f, char* buff, size_t len) = 0; // Записать данные в файл. Возвращаемое значение - сколько реально байт удалось записать
 		virtual void Close(File* f) = 0; // Закрыть файл	
@@ -1,13 +1,112 @@
 ﻿#pragma once
 
 #include "TestTask.h"
+#include "IOEngine.h"
+#include <functional>
+#include <future>
+#include <atomic>
+#include <map>
 
 namespace TestTask {
+	struct VFSOptions { // параметры, с которыми создаются новые VFS (уже существующие VFS их не меняют)
+		size_t clusterSize = defaultClusterSize; // pageClusterSize или largeClusterSize для больших файлов
+
+		StorageBackend backend = StorageBackend::Stream; // способ доступа к VFSData и VFSTable
+
+		size_t cacheSize = defaultCacheSize; // кэш страниц VFSData с отложенной записью (для StorageBackend::Stream; 0 - без кэша)
+
+		size_t ioThreads = 0; // потоки для асинхронных операций (0 - по количеству ядер)
+
+		size_t compactionRate = defaultCompactionRate; // скорость фонового уплотнения VFSData в байтах в секунду (0 - выключено)
+
+		size_t inlineThreshold = maxInlineSize; // файлы не длиннее хранятся прямо в записи VFSHeader, без кластеров (не больше maxInlineSize; 0 - всегда в кластерах)
+	};
+
 	struct textFS : public IVFS {
+		textFS(VFSOptions options_ = VFSOptions());
+
 		virtual File* Open(const char* name) final;
 		virtual File* Create(const char* name) final;
 		virtual size_t Read(File* f, char* buff, size_t len) final;
 		virtual size_t Write(File* f, char* buff, size_t len) final;
 		virtual void Close(File* f) final;
+
+		// Чтение и запись набором буферов (как readv/writev): буферы идут подряд в файле, а вся операция
+		// проходит цепочку кластеров один раз и сбрасывает данные один раз. Возвращают общее количество байт
+		size_t ReadV(File* f, const IOBuffer* buffers, size_t count);
+		size_t WriteV(File* f, const IOBuffer* buffers, size_t count);
+
+		// Чтение и запись с явной позицией от начала файла: курсор File не используется и не меняется,
+		// поэтому один File могут читать сразу несколько потоков. PWrite пишет не дальше конца файла (без дыр)
+		size_t PRead(File* f, size_t offset, char* buff, size_t len);
+		size_t PWrite(File* f, size_t offset, char* buff, size_t len);
+
+		// Прочитать данные без копирования: участки указывают прямо в VFSData (или в буфер File, если VFSData не отображен в память).
+		// Участки действительны до следующего ReadView или Close этого File
+		std::vector<std::string_view> ReadView(File* f, size_t len);
+
+		// Асинхронные чтение и запись. Операции одного File выполняются в порядке вызова, операции разных File - параллельно.
+		// buff должен оставаться живым до завершения операции; Close дожидается всех операций File.
+		// Close из onComplete или из корутины, продолжившейся в потоке пула, выполняется в той же очереди File:
+		// там он не ждет (иначе ждал бы сам себя) - операции File, поставленные после текущей, еще не выполнены
+		std::future<size_t> ReadAsync(File* f, char* buff, size_t len);
+		std::future<size_t> WriteAsync(File* f, char* buff, size_t len);
+		void ReadAsync(File* f, char* buff, size_t len, std::function<void(size_t)> onComplete);
+		void WriteAsync(File* f, char* buff, size_t len, std::function<void(size_t)> onComplete);
+
+		// Корутинные аналоги IVFS: co_await не блокирует вызывающий поток, операция идет в пуле потоков,
+		// и корутина продолжается в потоке пула. Порядок операций одного File сохраняется
+		IOAwaitable<File*> co_open(const char* name);
+		IOAwaitable<File*> co_create(const char* name);
+		IOAwaitable<size_t> co_read(File* f, char* buff, size_t len);
+		IOAwaitable<size_t> co_write(File* f, char* buff, size_t len);
+		IOAwaitable<void> co_close(File* f);
+
+		// Перемещение курсора File. Возвращает новую позицию от начала файла или -1, если она вне файла.
+		// Конец файла - его длина (для читателя - на момент открытия)
+		int64_t Seek(File* f, int64_t offset, SeekOrigin origin = SeekOrigin::Begin);
+		size_t Tell(File* f); // позиция курсора от начала файла
+
+		// Удаление файла или пустой директории; кластеры файла сразу возвращаются в VFS. false, если файла нет или он открыт
+		bool Remove(const char* name);
+
+		// Изменение длины файла, открытого на запись: при укорачивании освобождается хвост цепочки
+		// (если файл больше никем не открыт), при удлинении файл дописывается нулями. Курсор File не дальше нового конца
+		bool Truncate(File* f, size_t length);
+
+		std::vector<DirectoryEntry> ListDirectory(const char* name); // содержимое директории VFS в порядке возрастания имен
+
+		void Sync(File* f); // сброс на диск данных и таблицы кластеров VFS, в которой лежит файл
+
+	private:
+		VFSOptions options;
+
+		std::shared_ptr<VFSMount> mountVFS(const std::filesystem::path& VFSPath);
+
+		std::filesystem::path resolveVFS(const std::string& filePath); // findVFSPath с кэшем по директории файла
+
+		File* openFile(const std::filesystem::path& VFSPath, const std::string& filePath, FileStatus status);
+
+		void releaseFile(File* f); // закрытие без ожидания асинхронных операций File
+
+		void readAhead(File* f); // подкачка следующих кластеров, пока File читается подряд
+
+		std::map<std::filesystem::path, std::shared_ptr<VFSMount>> mounts; // уже подключенные VFS
+
+		std::mutex mountsAccess;
+
+		std::map<std::filesystem::path, std::filesystem::path> VFSRoots; // директория файла -> папка найденной для нее VFS
+
+		std::mutex VFSRootsAccess;
+
+		std::mutex VFSInitAccess; // создание новой VFS
+
+		IOEngine& engine(); // пул потоков создается при первой асинхронной операции
+
+		std::atomic<IOEngine*> startedEngine = nullptr; // ioEngine после создания: читается без once_flag
+
+		std::unique_ptr<IOEngine> ioEngine; // разрушается раньше полей выше, пока VFS еще подключены
+
+		std::once_flag ioEngineStarted;
 	};
 }
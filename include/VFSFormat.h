@@ -0,0 +1,82 @@
+﻿#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace TestTask {
+
+	// Бинарный формат VFS (версия 3). Все числа хранятся в little-endian.
+	// VFSHeader: суперблок фиксированного размера, за ним записи о файлах и директориях фиксированного размера.
+	// Запись хранит имя одного компонента пути и номер записи родительской директории.
+	// VFSTable: ссылка на следующий кластер для кластера i лежит по смещению i * tableEntrySize.
+	// В версии 2 записи были только о файлах и хранили полный путь - такие VFS перестраиваются при подключении.
+
+	inline const char VFSMagic[4] = { 'T', 'V', 'F', 'S' };
+	inline const uint32_t VFSFormatVersion = 3;
+	inline const uint32_t flatDirectoryFormatVersion = 2; // последняя версия без дерева директорий
+
+	inline const size_t superBlockSize = 256; // размер суперблока в начале VFSHeader
+	inline const size_t fileRecordSize = 512; // размер одной записи о файле в VFSHeader
+	inline const size_t maxFileNameLength = 255; // максимальная длина имени файла или директории
+	inline const size_t tableEntrySize = 8; // размер одной ссылки в VFSTable
+	inline const size_t fileLengthOffset = 288; // длина файла в записи: ее пишет только писатель файла, остальная запись пишется без нее
+	inline const size_t inlineDataOffset = 296; // данные файла без кластеров - прямо в записи, до ее конца
+	inline const size_t maxInlineSize = fileRecordSize - inlineDataOffset;
+
+	inline const size_t headerGenerationOffset = 16; // счетчики изменений в суперблоке; по ним же процессы блокируют VFSHeader и VFSTable
+	inline const size_t tableGenerationOffset = 24;
+	inline const size_t generationSize = 8;
+	inline const size_t freeSpaceSummaryOffset = 32; // сводка карты свободных кластеров и флаг чистого отключения
+	inline const size_t freeSpaceSummarySize = 28;
+	inline const size_t mountLockOffset = 60; // каждая подключившая VFS копия держит здесь разделяемую блокировку
+	inline const size_t mountLockSize = 4;
+	inline const size_t recentRecordsOffset = 64; // кольцо последних изменений записей: по нему другие процессы перечитывают только измененные записи
+	inline const size_t recentRecordsCount = 8;
+	inline const size_t recentRecordSize = 16; // headerGeneration изменения (int64) и номер записи (int64)
+
+	inline const int64_t rootDirectory = -1; // родитель записей, лежащих в корне VFS
+	inline const int64_t didNotFindRecord = -2;
+
+	void putInt32(char* buff, int32_t value);
+	int32_t getInt32(const char* buff);
+	void putInt64(char* buff, int64_t value);
+	int64_t getInt64(const char* buff);
+
+	struct VFSInfo { // суперблок VFS (начало VFSHeader)
+		operator bool() { return clusterSize > 0; }
+		uint32_t formatVersion = VFSFormatVersion;
+		int64_t clusterSize = -1;
+		uint64_t headerGeneration = 0; // растет при каждом изменении записей о файлах
+		uint64_t tableGeneration = 0; // растет при каждом изменении VFSTable
+		int64_t freeClusters = 0; // сводка карты свободных кластеров на момент отключения
+		int64_t freeSearchHint = 0;
+		uint64_t summaryGeneration = 0; // tableGeneration, при котором записана сводка
+		bool cleanShutdown = false; // VFS отключили чисто - сводке можно верить, если VFSTable с тех пор не менялась
+
+		void serialize(char* buff) const; // buff - не меньше superBlockSize байт
+		bool deserialize(const char* buff); // false, если это не суперблок VFS поддерживаемой версии
+	};
+
+	struct FileInfo { // запись о файле или директории в VFSHeader
+		std::string fileName; // имя внутри родительской директории
+		int64_t firstCluster = -1; // у файла без кластеров данные лежат в записи (inlineDataOffset)
+		std::string mode; // WO, пока файл открыт хоть одним писателем
+		int32_t numberOfThreads = 0; // количество открытых писателей (File в режиме WO)
+		int32_t numberOfReaders = 0; // количество открытых читателей - они читают снимок и писателям не мешают
+		int64_t parent = rootDirectory; // номер записи родительской директории
+		bool isDirectory = false;
+		int64_t length = -1; // длина файла в байтах (-1 - не записана: файл из VFS, где длины еще не было)
+
+		FileInfo() = default;
+
+		FileInfo(const std::string fileName_, int64_t firstCluster_, std::string mode_, int32_t numberOfThreads_) :
+			fileName(fileName_), firstCluster(firstCluster_), mode(mode_), numberOfThreads(numberOfThreads_) {};
+
+		void serialize(char* buff) const; // buff - не меньше fileRecordSize байт
+		void deserialize(const char* buff);
+	};
+
+	bool isTextVFS(const std::filesystem::path& VFSPath); // VFS в старом текстовом формате (версия 1)
+
+	void convertTextVFS(const std::filesystem::path& VFSPath); // однократная конвертация VFS из версии 1 в версию 2
+}
@@ -0,0 +1,159 @@
+﻿#pragma once
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ClusterTable.h"
+#include "Storage.h"
+#include "VFSFormat.h"
+
+namespace TestTask {
+
+	inline const size_t defaultCompactionRate = size_t(8) << 20; // байт в секунду, которые фоновое уплотнение переносит в VFSData
+	inline const size_t compactionMaxFileBytes = size_t(16) << 20; // файлы больше этого не переносятся - их перенос держал бы VFS слишком долго
+	inline const size_t compactionRecordsPerStep = 256; // сколько записей просматривается за шаг в поисках файла для переноса
+	inline const size_t compactionBufferSize = size_t(1) << 20; // данные переносятся кусками такого размера
+
+	struct DirectoryEntry { // элемент содержимого директории
+		std::string name;
+		bool isDirectory = false;
+	};
+
+	// Подключенная VFS: файлы VFS и их содержимое, открытые один раз и общие для всех File этой VFS.
+	// Одну VFS могут подключить несколько процессов: изменения записей и VFSTable идут под fcntl-блокировками,
+	// а кэш в памяти перечитывается, только если счетчик изменений в суперблоке разошелся с запомненным.
+	// Журнал VFSTable сбрасывается в фоновом потоке: по времени или когда он вырос.
+	// Тот же поток понемногу уплотняет VFSData: переносит цепочки закрытых файлов в непрерывные участки ближе к началу
+	// и отрезает освободившийся хвост.
+	class VFSMount {
+	public:
+		VFSMount(const std::filesystem::path& VFSPath_, StorageBackend backend, size_t cacheSize, size_t compactionRate_, size_t inlineLimit_);
+
+		~VFSMount(); // последняя контрольная точка журнала
+
+		const std::filesystem::path& getPath() { return VFSPath; }
+
+		size_t getClusterSize() { return size_t(info.clusterSize); }
+
+		size_t getInlineLimit() { return inlineLimit; } // новые файлы не длиннее этого не получают кластеров
+
+		// отметка об открытии, возвращает первый кластер файла; recordNumber - номер записи о файле,
+		// inlineData - куда прочитать данные файла без кластеров (под той же блокировкой, что и запись)
+		int64_t openFile(const std::string& filePath, const std::string& mode, bool create, size_t& recordNumber, std::vector<char>* inlineData = nullptr);
+
+		void closeFile(size_t recordNumber, const std::string& mode); // отметка о закрытии
+
+		bool removeFile(const std::string& filePath); // удаление файла или пустой директории; false, если их нет или файл открыт
+
+		bool truncateFile(size_t recordNumber, size_t length); // укорачивание файла; кластеры освобождаются (true), только если он больше никем не открыт
+
+		std::mutex& fileLock(size_t recordNumber); // блокировка писателей файла, общая для всех его File
+
+		size_t fileLength(size_t recordNumber); // длина файла прямо из VFSHeader (без записанной длины - вся цепочка)
+
+		size_t extendFileLength(size_t recordNumber, size_t end); // длина растет до end, если он дальше; под блокировкой записи о файле
+
+		int64_t firstCluster(size_t recordNumber); // первый кластер по актуальной записи (отрицательный - данные в записи)
+
+		std::vector<char> readInline(size_t recordNumber); // данные файла без кластеров одним чтением вместе с длиной (записи не перечитываются)
+
+		void writeInline(size_t recordNumber, size_t offset, const char* buff, size_t len); // запись в них без flush; под блокировкой записи о файле
+
+		int64_t promoteFile(size_t recordNumber); // перенос данных из записи в кластеры, возвращает первый кластер
+
+		std::vector<Extent> allocateChain(int64_t tail, size_t count); // выделение кластеров под блокировкой VFSTable
+
+		void refreshClusterTable(); // перечитать VFSTable, если ее изменил другой процесс
+
+		bool listDirectory(const std::string& directoryPath, std::vector<DirectoryEntry>& entries); // false, если директории нет
+
+		void sync();
+
+		void checkpoint(); // контрольная точка журнала VFSTable
+
+		size_t compactStep(size_t maxBytes); // перенос одного файла; возвращает, сколько байт перенесено
+
+		ClusterTable clusterTable;
+
+		std::unique_ptr<IStorage> VFSData;
+
+		ProcessLock processLock; // межпроцессные блокировки: участки счетчиков в суперблоке и записи о файлах
+
+	private:
+		void refreshHeader(); // перечитать записи, если их изменил другой процесс (headerAccess и блокировка VFSHeader взяты)
+
+		bool reloadChangedRecords(uint64_t generation); // перечитать только измененные записи; false - нужен loadDirectory
+
+		void refreshTable(); // то же для VFSTable (tableAccess и блокировка VFSTable взяты)
+
+		uint64_t readGeneration(size_t offset);
+
+		void writeGeneration(size_t offset, uint64_t generation);
+
+		std::vector<std::string> splitPath(const std::string& path); // компоненты пути относительно корня VFS
+
+		void loadDirectory(); // чтение всех записей и построение дерева директорий
+
+		void upgradeFlatDirectory(); // перестройка записей с полными путями (версия 2) в дерево
+
+		void resetOpenCounts(); // обнуление счетчиков открытых File, оставшихся от упавших процессов (VFS больше никем не подключена)
+
+		int64_t findDirectory(const std::vector<std::string>& components, size_t depth, bool create);
+
+		size_t addRecord(const FileInfo& fileInfo);
+
+		void writeFileInfo(size_t recordNumber, const FileInfo& fileInfo, bool withLength = false); // длина пишется для новых записей или по withLength
+
+		void writeSuperBlock();
+
+		void writeFreeSpaceSummary(); // сводка карты и флаг чистого отключения (VFSTable заблокирована)
+
+		size_t moveFile(size_t recordNumber, size_t maxBytes); // перенос цепочки файла (обе блокировки взяты), 0 - файл не переносился
+
+		void trimData(); // отрезание свободного хвоста VFSData, если VFS больше никем не подключена (обе блокировки взяты)
+
+		void backgroundLoop(); // фоновый поток: контрольные точки и уплотнение
+
+		std::filesystem::path VFSPath;
+
+		VFSInfo info;
+
+		std::unique_ptr<IStorage> VFSHeader;
+
+		std::vector<FileInfo> records; // записи из VFSHeader в том же порядке
+
+		std::unordered_map<int64_t, std::map<std::string, size_t>> directories; // номер записи директории -> упорядоченный индекс ее содержимого
+
+		std::vector<size_t> freeRecords; // записи удаленных файлов, которые займут следующие новые файлы
+
+		std::deque<std::mutex> fileLocks; // по одной на запись; deque не перемещает элементы при росте
+
+		std::vector<int32_t> localWriters; // писатели файла из этого процесса: остальные пишут мимо нашего кэша VFSData
+
+		std::mutex headerAccess; // защищает VFSHeader, records, directories, freeRecords, fileLocks, localWriters и info.headerGeneration
+
+		std::mutex tableAccess; // защищает info.tableGeneration; берется после headerAccess
+
+		std::mutex lengthAccess; // поля длины в VFSHeader: писатель файла меняет их без headerAccess
+
+		size_t compactionRate; // 0 - уплотнение выключено
+
+		size_t inlineLimit; // 0 - все файлы в кластерах
+
+		size_t compactionCursor = 0; // с этой записи продолжается поиск файлов для переноса; только в фоновом потоке
+
+		std::mutex checkpointAccess;
+
+		std::condition_variable checkpointWake;
+
+		bool stopping = false; // защищен checkpointAccess
+
+		std::thread background; // запускается последним, когда VFS уже подключена
+	};
+}
@@ -0,0 +1,452 @@
+﻿#include "TestTask.h"
+#include <algorithm>
+#include <bit>
+
+TestTask::ClusterTable::ClusterTable(std::filesystem::path VFSPath_, StorageBackend backend)
+	: VFSTable(openStorage(VFSPath_ / VFSTableFileName, backend)), freeSpace(VFSPath_), journal(VFSPath_ / VFSJournalFileName) {
+}
+
+/// <summary>
+/// Восстановление после сбоя. Журнал очищается на каждой контрольной точке, поэтому непустой журнал значит,
+/// что VFSTable и карта на диске могли отстать от него: целые записи журнала применяются заново, а карта строится по таблице
+/// </summary>
+/// <param name="summary"> - Сводка карты с чистого отключения (nullptr - карта проверяется по таблице)</param>
+/// <param name="repair"> - VFS отключили не чисто: выделения без сброса журнала могли попасть на диск не целиком,
+/// а карта - отстать от таблицы. Цепочки проверяются, карта строится заново по таблице</param>
+void TestTask::ClusterTable::recover(const FreeSpaceSummary* summary, bool repair) {
+
+	bool replayNeeded = journal.size() != 0;
+
+	if (replayNeeded) {
+		for (const LinkUpdate& update : journal.replay()) {
+			char buff[tableEntrySize];
+			putInt64(buff, update.next);
+			VFSTable->write(update.cluster * tableEntrySize, buff, tableEntrySize);
+		}
+		VFSTable->flush();
+	}
+
+	reload(replayNeeded ? nullptr : summary);
+
+	if (replayNeeded || repair) {
+		std::lock_guard allocationGuard(allocation);
+		std::lock_guard tableGuard(access);
+
+		if (repair) {
+			repairChains();
+		}
+		freeSpace.rebuild(links); // карта могла не успеть на диск раньше сбоя - иначе занятые кластеры выделились бы повторно
+		VFSTable->sync();
+		freeSpace.sync();
+		if (replayNeeded) {
+			journal.reset();
+		}
+	}
+}
+
+/// <summary>
+/// Проверка цепочек после возможного сбоя. Выделение при дописывании пишет в VFSTable ссылки нового участка и ссылку
+/// на него с хвоста файла, не дожидаясь диска, и ОС могла сохранить только вторую. Тогда цепочка ведет в пустой кластер,
+/// который карта считает свободным, - она обрывается перед ним: данные участка все равно не успели на диск
+/// </summary>
+void TestTask::ClusterTable::repairChains() {
+
+	for (size_t cluster = 0; cluster < links.size(); ++cluster) {
+		int64_t next = links[cluster];
+		if (next >= 0 && (size_t(next) >= links.size() || links[size_t(next)] == clusterIsEmpty)) {
+			links[cluster] = endOfFile;
+			writeLinks(cluster, 1);
+		}
+	}
+}
+
+void TestTask::ClusterTable::reload(const FreeSpaceSummary* summary) {
+
+	std::lock_guard allocationGuard(allocation);
+	std::lock_guard tableGuard(access);
+
+	// VFSTable читается целиком - при подключении VFS и после изменений другим процессом
+	if constexpr (std::endian::native == std::endian::little && sizeof(int64_t) == tableEntrySize) { // формат совпадает с памятью - читаем прямо в links
+		links.resize(VFSTable->size() / tableEntrySize);
+		links.resize(VFSTable->read(0, reinterpret_cast<char*>(links.data()), links.size() * tableEntrySize) / tableEntrySize);
+	}
+	else {
+		std::vector<char> buff(VFSTable->size());
+		buff.resize(VFSTable->read(0, buff.data(), buff.size()));
+
+		links.resize(buff.size() / tableEntrySize);
+		for (size_t i = 0; i < links.size(); ++i) {
+			links[i] = getInt64(buff.data() + i * tableEntrySize);
+		}
+	}
+
+	if (!freeSpace.load(links.size(), summary)) {
+		freeSpace.rebuild(links);
+	}
+}
+
+/// <summary>
+/// Поиск следующего кластера
+/// </summary>
+/// <param name="clusterNumber"> - Номер текущего кластера</param>
+/// <returns>Номер следующего кластера</returns>
+int64_t TestTask::ClusterTable::getNext(size_t clusterNumber) {
+
+	std::shared_lock tableGuard(access);
+
+	if (clusterNumber >= links.size()) {
+		return didNotFindCluster;
+	}
+	return links[clusterNumber];
+}
+
+/// <summary>
+/// Выделение цепочки кластеров одним действием
+/// </summary>
+/// <param name="tail"> - Последний кластер файла, к которому присоединяется цепочка (отрицательный - новый файл)</param>
+/// <param name="count"> - Количество кластеров</param>
+/// <returns>Выделенные участки в порядке следования в цепочке</returns>
+std::vector<TestTask::Extent> TestTask::ClusterTable::allocateChain(int64_t tail, size_t count) {
+
+	if (!count) {
+		return {};
+	}
+
+	std::lock_guard allocationGuard(allocation); // выделяющие кластеры потоки идут по одному, читатели таблицы их не ждут
+
+	std::vector<Extent> extents;
+	std::vector<LinkUpdate> updates; // все ссылки выделения - одна запись журнала
+	{
+		std::lock_guard tableGuard(access); // links меняется только под исключительной блокировкой
+
+		if (tail >= int64_t(links.size())) {
+			throw std::runtime_error("Invalid cluster number\n");
+		}
+
+		extents = freeSpace.allocate(count);
+
+		if (freeSpace.clusterCount() > links.size()) {
+			links.resize(freeSpace.clusterCount(), clusterIsEmpty);
+		}
+
+		for (size_t e = 0; e < extents.size(); ++e) { // внутри участка кластеры идут подряд, участки связываются между собой
+			const Extent& extent = extents[e];
+			for (size_t i = extent.first; i + 1 < extent.first + extent.length; ++i) {
+				links[i] = int64_t(i + 1);
+			}
+			links[extent.first + extent.length - 1] = e + 1 < extents.size() ? int64_t(extents[e + 1].first) : endOfFile;
+			for (size_t i = extent.first; i < extent.first + extent.length; ++i) {
+				updates.push_back(LinkUpdate{ i, links[i] });
+			}
+		}
+	}
+
+	if (tail >= 0) {
+		updates.push_back(LinkUpdate{ size_t(tail), int64_t(extents.front().first) });
+	}
+	if (tail >= 0) { // до записи в VFSTable, но без fdatasync: после сбоя процесса выделение применится целиком, после сбоя питания цепочку проверит recover
+		journal.append(updates);
+	}
+	else { // на новую цепочку сошлется запись о файле, а ее recover не проверяет
+		journal.commit(updates);
+	}
+
+	{
+		std::shared_lock tableGuard(access); // новые кластеры еще никому не видны - запись на диск не мешает читателям
+		for (const Extent& extent : extents) {
+			writeLinks(extent.first, extent.length); // ссылки участка лежат в VFSTable подряд - одна запись на участок
+		}
+	}
+
+	if (tail >= 0) { // цепочка становится видна файлу только после того, как полностью записана
+		std::lock_guard tableGuard(access);
+		links[tail] = int64_t(extents.front().first);
+		writeLinks(tail, 1);
+	}
+
+	return extents;
+}
+
+/// <summary>
+/// Поиск участка цепочки, кластеры которого идут в VFSData подряд
+/// </summary>
+/// <param name="from"> - Первый кластер участка</param>
+/// <param name="maxLength"> - Максимальная длина участка</param>
+/// <returns>Участок, начинающийся с from</returns>
+TestTask::Extent TestTask::ClusterTable::getRun(size_t from, size_t maxLength) {
+
+	std::shared_lock tableGuard(access);
+
+	if (from >= links.size()) {
+		throw std::runtime_error("Invalid cluster number\n");
+	}
+
+	Extent run{ from, 1 };
+	while (run.length < maxLength && links[run.first + run.length - 1] == int64_t(run.first + run.length)) {
+		++run.length;
+	}
+	return run;
+}
+
+/// <summary>
+/// Подсчет кластеров цепочки. Хвост цепочки публикуется одной записью ссылки,
+/// поэтому под разделяемой блокировкой цепочка всегда целая
+/// </summary>
+/// <param name="first"> - Первый кластер цепочки</param>
+/// <returns>Количество кластеров</returns>
+size_t TestTask::ClusterTable::chainLength(size_t first) {
+
+	std::shared_lock tableGuard(access);
+
+	size_t length = 0;
+	for (int64_t cluster = int64_t(first); cluster >= 0 && size_t(cluster) < links.size() && length < links.size(); cluster = links[cluster]) {
+		++length;
+	}
+	return length;
+}
+
+/// <summary>
+/// Разбиение цепочки на участки, кластеры которых идут в VFSData подряд
+/// </summary>
+/// <param name="first"> - Первый кластер цепочки</param>
+/// <returns>Участки в порядке следования в цепочке</returns>
+std::vector<TestTask::Extent> TestTask::ClusterTable::chainRuns(size_t first) {
+
+	std::shared_lock tableGuard(access);
+	return collectRuns(int64_t(first));
+}
+
+std::vector<TestTask::Extent> TestTask::ClusterTable::collectRuns(int64_t cluster) {
+
+	std::vector<Extent> runs;
+	size_t length = 0;
+	for (; cluster >= 0 && size_t(cluster) < links.size() && length < links.size(); cluster = links[cluster]) {
+		if (!runs.empty() && runs.back().first + runs.back().length == size_t(cluster)) {
+			++runs.back().length;
+		}
+		else {
+			runs.push_back(Extent{ size_t(cluster), 1 });
+		}
+		++length;
+	}
+	return runs;
+}
+
+/// <summary>
+/// Выделение непрерывного участка под перенос цепочки. Ссылки участка остаются пустыми до linkRun:
+/// при сбое в промежутке кластеры потеряются, но ни в какой файл не попадут
+/// </summary>
+/// <param name="count"> - Количество кластеров</param>
+/// <param name="limit"> - Участок должен закончиться не дальше этого кластера</param>
+/// <returns>Участок (length = 0, если подходящего нет)</returns>
+TestTask::Extent TestTask::ClusterTable::reserveRun(size_t count, size_t limit) {
+
+	std::lock_guard allocationGuard(allocation);
+	std::lock_guard tableGuard(access);
+
+	Extent run = freeSpace.allocateRun(count, limit);
+	if (freeSpace.clusterCount() > links.size()) {
+		links.resize(freeSpace.clusterCount(), clusterIsEmpty);
+	}
+	return run;
+}
+
+/// <summary>
+/// Связывание выделенного участка в самостоятельную цепочку
+/// </summary>
+/// <param name="run"> - Участок из reserveRun</param>
+void TestTask::ClusterTable::linkRun(Extent run) {
+
+	if (!run.length) {
+		return;
+	}
+
+	std::lock_guard allocationGuard(allocation);
+	{
+		std::shared_lock tableGuard(access);
+		if (run.first + run.length > links.size()) {
+			throw std::runtime_error("Invalid cluster number\n");
+		}
+	}
+
+	std::vector<LinkUpdate> updates;
+	for (size_t i = run.first; i < run.first + run.length; ++i) {
+		updates.push_back(LinkUpdate{ i, i + 1 < run.first + run.length ? int64_t(i + 1) : endOfFile });
+	}
+	journal.commit(updates); // участок никому не виден - сброс журнала идет без блокировки таблицы
+
+	std::lock_guard tableGuard(access);
+	for (const LinkUpdate& update : updates) {
+		links[update.cluster] = update.next;
+	}
+	writeLinks(run.first, run.length);
+}
+
+void TestTask::ClusterTable::freeRuns(const std::vector<Extent>& runs) {
+
+	std::lock_guard allocationGuard(allocation);
+	unlinkRuns(runs, {});
+}
+
+/// <summary>
+/// Укорачивание цепочки. Новый конец и освобожденный хвост - одна запись журнала
+/// </summary>
+/// <param name="first"> - Первый кластер цепочки</param>
+/// <param name="keep"> - Сколько кластеров оставить (не меньше одного)</param>
+/// <returns>Количество освобожденных кластеров</returns>
+size_t TestTask::ClusterTable::truncateChain(size_t first, size_t keep) {
+
+	std::lock_guard allocationGuard(allocation); // без нее links не меняется - найденный хвост останется верным
+
+	size_t last = first;
+	std::vector<Extent> runs;
+	{
+		std::shared_lock tableGuard(access);
+
+		for (size_t i = 1; i < std::max<size_t>(keep, 1); ++i) {
+			if (last >= links.size() || links[last] < 0) { // цепочка и так не длиннее
+				return 0;
+			}
+			last = size_t(links[last]);
+		}
+		if (last >= links.size()) {
+			throw std::runtime_error("Invalid cluster number\n");
+		}
+		runs = collectRuns(links[last]);
+	}
+
+	if (runs.empty()) {
+		return 0;
+	}
+
+	unlinkRuns(runs, { LinkUpdate{ last, endOfFile } });
+
+	size_t freed = 0;
+	for (const Extent& run : runs) {
+		freed += run.length;
+	}
+	return freed;
+}
+
+/// <summary>
+/// Освобождение участков. Все ссылки уходят одной записью журнала, в VFSTable - одной записью на участок;
+/// карта обновляется после таблицы, чтобы кластер не выдали повторно, пока на него есть ссылка
+/// </summary>
+/// <param name="runs"> - Освобождаемые участки</param>
+/// <param name="updates"> - Другие ссылки, которые меняются вместе с освобождением</param>
+void TestTask::ClusterTable::unlinkRuns(const std::vector<Extent>& runs, const std::vector<LinkUpdate>& updates) {
+
+	std::vector<LinkUpdate> journalUpdates(updates);
+	{
+		std::shared_lock tableGuard(access);
+
+		for (const Extent& run : runs) {
+			if (run.first + run.length > links.size()) {
+				throw std::runtime_error("Invalid cluster number\n");
+			}
+			for (size_t i = run.first; i < run.first + run.length; ++i) {
+				journalUpdates.push_back(LinkUpdate{ i, clusterIsEmpty });
+			}
+		}
+	}
+	journal.commit(journalUpdates); // под allocation таблица не меняется - читатели не ждут сброса журнала
+
+	{
+		std::lock_guard tableGuard(access); // исключительная блокировка - только на изменение links и запись VFSTable
+
+		for (const LinkUpdate& update : updates) {
+			links[update.cluster] = update.next;
+			writeLinks(update.cluster, 1);
+		}
+		for (const Extent& run : runs) {
+			std::fill(links.begin() + run.first, links.begin() + run.first + run.length, int64_t(clusterIsEmpty));
+			writeLinks(run.first, run.length);
+		}
+	}
+
+	for (const Extent& run : runs) {
+		freeSpace.release(run.first, run.length);
+	}
+}
+
+/// <summary>
+/// Отрезание свободного хвоста VFSTable и карты. Журнал может ссылаться на отрезаемые кластеры,
+/// поэтому сначала - контрольная точка. VFSData укорачивает владелец
+/// </summary>
+/// <returns>Количество оставшихся кластеров</returns>
+size_t TestTask::ClusterTable::trimFreeTail() {
+
+	std::lock_guard allocationGuard(allocation);
+	std::lock_guard tableGuard(access);
+
+	size_t used = links.size();
+	while (used > 1 && links[used - 1] == clusterIsEmpty && !freeSpace.isUsed(used - 1)) { // выделенный под перенос участок ссылок еще не имеет
+		--used;
+	}
+	if (used == links.size()) {
+		return used;
+	}
+
+	if (journal.size()) {
+		VFSTable->sync();
+		freeSpace.sync();
+		journal.reset();
+	}
+
+	links.resize(used);
+	VFSTable->truncate(used * tableEntrySize); // если сбой случится до укорачивания карты, она не совпадет с таблицей и будет перестроена
+	freeSpace.truncate(used);
+	return used;
+}
+
+size_t TestTask::ClusterTable::size() {
+	std::shared_lock tableGuard(access);
+	return links.size();
+}
+
+/// <summary>
+/// Запись ссылок в VFSTable. Ссылки имеют фиксированный размер,
+/// поэтому участок таблицы записывается одной записью по смещению first * tableEntrySize
+/// </summary>
+/// <param name="first"> - Номер первого кластера</param>
+/// <param name="count"> - Количество ссылок</param>
+void TestTask::ClusterTable::writeLinks(size_t first, size_t count) {
+
+	std::vector<char> buff(count * tableEntrySize);
+	for (size_t i = 0; i < count; ++i) {
+		putInt64(buff.data() + i * tableEntrySize, links[first + i]);
+	}
+
+	VFSTable->write(first * tableEntrySize, buff.data(), buff.size()); // видимой для других процессов запись делает flush
+}
+
+void TestTask::ClusterTable::flush() {
+	VFSTable->flush();
+}
+
+void TestTask::ClusterTable::sync() {
+
+	std::lock_guard allocationGuard(allocation); // карта меняется только под allocation
+
+	journal.sync(); // выделения, дописанные без fdatasync, - раньше ссылок в VFSTable
+	VFSTable->sync();
+	freeSpace.sync(); // иначе после сбоя питания карта отстала бы от уже надежных ссылок
+}
+
+TestTask::FreeSpaceSummary TestTask::ClusterTable::freeSpaceSummary() {
+	std::lock_guard allocationGuard(allocation);
+	return freeSpace.summary();
+}
+
+void TestTask::ClusterTable::checkpoint() {
+
+	std::lock_guard allocationGuard(allocation); // новые записи в журнал подождут, пока он не очищен
+
+	if (!journal.size()) {
+		return;
+	}
+
+	VFSTable->sync(); // все записи журнала уже применены к VFSTable - после сброса на диск они не нужны
+	freeSpace.sync();
+	journal.reset();
+}
@@ -0,0 +1,298 @@
+﻿#include "TestTask.h"
+#include <bit>
+
+TestTask::FreeSpaceMap::FreeSpaceMap(std::filesystem::path VFSPath_) : bitmapPath(VFSPath_ / VFSBitmapFileName) {
+
+	if (!std::filesystem::exists(bitmapPath)) { // карта появилась вместе с аллокатором - у старых VFS ее может не быть
+		std::ofstream(bitmapPath, std::ios::binary);
+	}
+
+	VFSBitmap.open(bitmapPath, std::ios::in | std::ios::out | std::ios::binary);
+
+	if (!VFSBitmap.is_open() || VFSBitmap.bad()) {
+		throw std::runtime_error("Could not open VFS bitmap\n");
+	}
+}
+
+TestTask::FreeSpaceMap::~FreeSpaceMap() {
+	VFSBitmap.close();
+}
+
+/// <summary>
+/// Загрузка карты с диска
+/// </summary>
+/// <param name="clusterCount_"> - Количество кластеров в VFSTable</param>
+/// <param name="summary"> - Счетчики, сохраненные при чистом отключении (nullptr - посчитать по карте)</param>
+/// <returns>false, если размер карты на диске не соответствует таблице</returns>
+bool TestTask::FreeSpaceMap::load(size_t clusterCount_, const FreeSpaceSummary* summary) {
+
+	VFSBitmap.clear();
+	VFSBitmap.seekg(0, std::ios::end);
+	size_t fileSize = size_t(VFSBitmap.tellg());
+
+	if (fileSize != (clusterCount_ + 7) / 8) {
+		return false;
+	}
+
+	bits.resize(fileSize);
+	VFSBitmap.seekg(0, std::ios::beg);
+	if (!VFSBitmap.read(reinterpret_cast<char*>(bits.data()), fileSize)) {
+		VFSBitmap.clear();
+		return false;
+	}
+
+	clusters = clusterCount_;
+
+	if (summary && summary->freeClusters <= clusters && summary->searchHint <= clusters) {
+		freeCount = summary->freeClusters;
+		searchHint = summary->searchHint;
+		return true;
+	}
+
+	freeCount = clusters;
+	searchHint = clusters;
+	for (size_t byte = 0; byte < bits.size(); ++byte) { // по байту за шаг: биты за последним кластером всегда нулевые
+		freeCount -= size_t(std::popcount(bits[byte]));
+		if (searchHint == clusters && bits[byte] != 0xFF) {
+			searchHint = std::min(clusters, byte * 8 + size_t(std::countr_one(bits[byte])));
+		}
+	}
+	return true;
+}
+
+void TestTask::FreeSpaceMap::rebuild(const std::vector<int64_t>& links) {
+
+	clusters = links.size();
+	bits.assign((clusters + 7) / 8, 0);
+	freeCount = 0;
+	searchHint = clusters;
+
+	for (size_t i = 0; i < clusters; ++i) {
+		if (links[i] == clusterIsEmpty) {
+			++freeCount;
+			searchHint = std::min(searchHint, i);
+		}
+		else {
+			bits[i / 8] |= uint8_t(1 << (i % 8));
+		}
+	}
+
+	VFSBitmap.flush();
+	std::filesystem::resize_file(bitmapPath, bits.size());
+	writeRange(0, clusters);
+}
+
+/// <summary>
+/// Выделение кластеров. Поиск идет от первого свободного кластера, найденные свободные участки
+/// отдаются целиком; если их не хватает - карта (и VFS) расширяется в конец одним участком
+/// </summary>
+/// <param name="count"> - Сколько кластеров нужно</param>
+/// <returns>Выделенные участки в порядке следования в файле</returns>
+std::vector<TestTask::Extent> TestTask::FreeSpaceMap::allocate(size_t count) {
+
+	std::vector<Extent> extents;
+	size_t position = searchHint;
+
+	while (count && freeCount && position < clusters) {
+
+		if (bits[position / 8] == 0xFF && position % 8 == 0) { // целиком занятый байт пропускаем
+			position += 8;
+			continue;
+		}
+		if (isUsed(position)) {
+			++position;
+			continue;
+		}
+
+		Extent extent{ position, 0 };
+		while (position < clusters && !isUsed(position) && extent.length < count) {
+			++extent.length;
+			++position;
+		}
+		setRange(extent.first, extent.length, true);
+		writeRange(extent.first, extent.length);
+		freeCount -= extent.length;
+		count -= extent.length;
+		extents.push_back(extent);
+	}
+
+	searchHint = freeCount ? position : clusters; // все просмотренные кластеры теперь заняты
+
+	if (count) { // свободных кластеров не хватило - расширяемся
+		Extent extent{ clusters, count };
+		clusters += count;
+		bits.resize((clusters + 7) / 8, 0);
+		setRange(extent.first, extent.length, true);
+		writeRange(extent.first, extent.length);
+
+		if (!extents.empty() && extents.back().first + extents.back().length == extent.first) {
+			extents.back().length += extent.length;
+		}
+		else {
+			extents.push_back(extent);
+		}
+		searchHint = clusters;
+	}
+
+	return extents;
+}
+
+/// <summary>
+/// Выделение одного непрерывного участка - первого подходящего от начала VFS. Свободный хвост карты
+/// продолжается за ее концом, поэтому участок может и расширить VFS, если limit это позволяет
+/// </summary>
+/// <param name="count"> - Сколько кластеров нужно</param>
+/// <param name="limit"> - Участок должен закончиться не дальше этого кластера</param>
+/// <returns>Выделенный участок (length = 0, если подходящего нет)</returns>
+TestTask::Extent TestTask::FreeSpaceMap::allocateRun(size_t count, size_t limit) {
+
+	if (!count) {
+		return {};
+	}
+
+	Extent run{ searchHint, 0 }; // свободные кластеры подряд перед position
+	size_t position = searchHint;
+
+	while (run.length < count && position < clusters && run.first + count <= limit) {
+
+		if (bits[position / 8] == 0xFF && position % 8 == 0) {
+			position += 8;
+			run = Extent{ position, 0 };
+			continue;
+		}
+		if (isUsed(position)) {
+			++position;
+			run = Extent{ position, 0 };
+			continue;
+		}
+		++run.length;
+		++position;
+	}
+
+	if (run.first + count > limit) {
+		return {};
+	}
+
+	freeCount -= run.length;
+	if (run.length < count) { // участок дошел до конца карты - недостающее добавляется в конец
+		clusters = run.first + count;
+		bits.resize((clusters + 7) / 8, 0);
+	}
+	setRange(run.first, count, true);
+	writeRange(run.first, count);
+
+	return Extent{ run.first, count };
+}
+
+/// <summary>
+/// Пометка участка кластеров как занятого
+/// </summary>
+/// <param name="first"> - Первый кластер участка</param>
+/// <param name="length"> - Длина участка</param>
+void TestTask::FreeSpaceMap::reserve(size_t first, size_t length) {
+
+	if (first + length > clusters) {
+		throw std::runtime_error("Invalid cluster number\n");
+	}
+
+	for (size_t i = first; i < first + length; ++i) {
+		if (!isUsed(i)) {
+			--freeCount;
+		}
+	}
+	setRange(first, length, true);
+	writeRange(first, length);
+}
+
+/// <summary>
+/// Освобождение участка кластеров
+/// </summary>
+/// <param name="first"> - Первый кластер участка</param>
+/// <param name="length"> - Длина участка</param>
+void TestTask::FreeSpaceMap::release(size_t first, size_t length) {
+
+	if (first + length > clusters) {
+		throw std::runtime_error("Invalid cluster number\n");
+	}
+
+	for (size_t i = first; i < first + length; ++i) {
+		if (isUsed(i)) {
+			++freeCount;
+		}
+	}
+	setRange(first, length, false);
+	writeRange(first, length);
+	searchHint = std::min(searchHint, first);
+}
+
+/// <summary>
+/// Отрезание хвоста карты. Отрезаемые кластеры должны быть свободны
+/// </summary>
+/// <param name="clusterCount_"> - Сколько кластеров останется</param>
+void TestTask::FreeSpaceMap::truncate(size_t clusterCount_) {
+
+	if (clusterCount_ >= clusters) {
+		return;
+	}
+
+	for (size_t i = clusterCount_; i < clusters; ++i) {
+		if (isUsed(i)) {
+			throw std::runtime_error("Could not shrink VFS bitmap\n");
+		}
+	}
+
+	freeCount -= clusters - clusterCount_;
+	clusters = clusterCount_;
+	bits.resize((clusters + 7) / 8); // биты за последним кластером уже нулевые
+	searchHint = std::min(searchHint, clusters);
+
+	VFSBitmap.flush();
+	std::filesystem::resize_file(bitmapPath, bits.size());
+}
+
+bool TestTask::FreeSpaceMap::isUsed(size_t clusterNumber) {
+	if (clusterNumber >= clusters) {
+		return false;
+	}
+	return bits[clusterNumber / 8] & (1 << (clusterNumber % 8));
+}
+
+void TestTask::FreeSpaceMap::setRange(size_t first, size_t length, bool used) {
+	for (size_t i = first; i < first + length; ++i) {
+		if (used) {
+			bits[i / 8] |= uint8_t(1 << (i % 8));
+		}
+		else {
+			bits[i / 8] &= uint8_t(~(1 << (i % 8)));
+		}
+	}
+}
+
+void TestTask::FreeSpaceMap::sync() {
+	VFSBitmap.flush();
+	syncFile(bitmapPath);
+}
+
+/// <summary>
+/// Запись на диск байтов карты, покрывающих участок - одна запись на участок
+/// </summary>
+/// <param name="first"> - Первый кластер участка</param>
+/// <param name="length"> - Длина участка</param>
+void TestTask::FreeSpaceMap::writeRange(size_t first, size_t length) {
+
+	if (!length) {
+		return;
+	}
+
+	if (VFSBitmap.bad()) {
+		throw std::runtime_error("Error while working with VFS bitmap\n");
+	}
+
+	size_t firstByte = first / 8;
+	size_t lastByte = (first + length - 1) / 8;
+
+	VFSBitmap.clear();
+	VFSBitmap.seekp(firstByte, std::ios::beg);
+	VFSBitmap.write(reinterpret_cast<const char*>(bits.data() + firstByte), lastByte - firstByte + 1);
+	VFSBitmap.flush();
+}
@@ -0,0 +1,64 @@
+﻿#include "IOEngine.h"
+#include <algorithm>
+
+TestTask::IOEngine::IOEngine(size_t threadCount) {
+
+	if (!threadCount) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (size_t i = 0; i < threadCount; ++i) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	for (size_t i = 0; i < threadCount; ++i) {
+		workers.emplace_back(&IOEngine::work, this, std::ref(*queues[i]));
+	}
+}
+
+TestTask::IOEngine::~IOEngine() {
+
+	for (std::unique_ptr<Queue>& queue : queues) {
+		std::lock_guard queueGuard(queue->access);
+		queue->stopping = true;
+		queue->ready.notify_all();
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+/// <summary>
+/// Постановка задачи в очередь
+/// </summary>
+/// <param name="key"> - Ключ очереди: задачи с одним ключом выполняются в порядке постановки</param>
+/// <param name="task"> - Задача</param>
+void TestTask::IOEngine::submit(const void* key, std::function<void()> task) {
+
+	Queue& queue = *queues[queueIndex(key)];
+
+	std::lock_guard queueGuard(queue.access);
+	queue.tasks.push_back(std::move(task));
+	queue.ready.notify_one();
+}
+
+bool TestTask::IOEngine::runsQueueOf(const void* key) {
+	return workers[queueIndex(key)].get_id() == std::this_thread::get_id();
+}
+
+void TestTask::IOEngine::work(Queue& queue) {
+
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock queueGuard(queue.access);
+			queue.ready.wait(queueGuard, [&queue]() { return queue.stopping || !queue.tasks.empty(); });
+
+			if (queue.tasks.empty()) { // остановка - только когда очередь опустела
+				return;
+			}
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		task();
+	}
+}
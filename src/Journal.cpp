@@ -0,0 +1,184 @@
+﻿#include "TestTask.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Расположение записи журнала
+// 0   magic (4 байта)
+// 4   количество изменений n (int32)
+// 8   n изменений: номер кластера (int64), новая ссылка (int64)
+// 8 + 16n  контрольная сумма FNV-1a байтов с 4 по 8 + 16n (int32)
+
+static uint32_t checksum(const char* buff, size_t len) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; ++i) {
+		hash = (hash ^ uint8_t(buff[i])) * 16777619u;
+	}
+	return hash;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+TestTask::Journal::Journal(const std::filesystem::path& path) {
+
+	fd = ::open(path.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644); // журнал появился позже остальных файлов VFS - у старых VFS его нет
+	if (fd < 0) {
+		throw std::runtime_error("Could not open " + path.filename().string() + "\n");
+	}
+}
+
+TestTask::Journal::~Journal() {
+	::close(fd);
+}
+
+/// <summary>
+/// Запись изменений ссылок в журнал и сброс его на диск
+/// </summary>
+/// <param name="updates"> - Изменения одного действия с таблицей: применятся после сбоя либо все, либо ни одно</param>
+void TestTask::Journal::commit(const std::vector<LinkUpdate>& updates) {
+
+	if (updates.empty()) {
+		return;
+	}
+
+	append(updates);
+
+	std::lock_guard journalGuard(access);
+	if (fdatasync(fd) != 0) {
+		throw std::runtime_error("Error while syncing VFS journal\n");
+	}
+}
+
+/// <summary>
+/// Запись изменений ссылок в журнал без ожидания диска
+/// </summary>
+/// <param name="updates"> - Изменения одного действия с таблицей</param>
+void TestTask::Journal::append(const std::vector<LinkUpdate>& updates) {
+
+	if (updates.empty()) {
+		return;
+	}
+
+	std::vector<char> record(journalRecordHeaderSize + updates.size() * journalUpdateSize + journalChecksumSize);
+	std::memcpy(record.data(), journalRecordMagic, sizeof(journalRecordMagic));
+	putInt32(record.data() + 4, int32_t(updates.size()));
+	for (size_t i = 0; i < updates.size(); ++i) {
+		putInt64(record.data() + journalRecordHeaderSize + i * journalUpdateSize, int64_t(updates[i].cluster));
+		putInt64(record.data() + journalRecordHeaderSize + i * journalUpdateSize + 8, updates[i].next);
+	}
+	size_t checksumOffset = record.size() - journalChecksumSize;
+	putInt32(record.data() + checksumOffset, int32_t(checksum(record.data() + 4, checksumOffset - 4)));
+
+	std::lock_guard journalGuard(access);
+
+	for (size_t written = 0; written < record.size();) { // O_APPEND: запись всегда в конец, даже после очистки другим процессом
+		ssize_t result = ::write(fd, record.data() + written, record.size() - written);
+		if (result < 0 && errno != EINTR) {
+			throw std::runtime_error("Error while writing VFS journal\n");
+		}
+		written += result > 0 ? size_t(result) : 0;
+	}
+}
+
+void TestTask::Journal::sync() {
+
+	std::lock_guard journalGuard(access);
+
+	if (fdatasync(fd) != 0) {
+		throw std::runtime_error("Error while syncing VFS journal\n");
+	}
+}
+
+/// <summary>
+/// Чтение журнала
+/// </summary>
+/// <returns>Изменения из всех целых записей в порядке записи</returns>
+std::vector<TestTask::LinkUpdate> TestTask::Journal::replay() {
+
+	std::lock_guard journalGuard(access);
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		throw std::runtime_error("Error while reading VFS journal\n");
+	}
+
+	std::vector<char> buff(size_t(fileStat.st_size));
+	size_t symbolsRead = 0;
+	while (symbolsRead < buff.size()) {
+		ssize_t result = ::pread(fd, buff.data() + symbolsRead, buff.size() - symbolsRead, off_t(symbolsRead));
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			break;
+		}
+		symbolsRead += size_t(result);
+	}
+	buff.resize(symbolsRead);
+
+	std::vector<LinkUpdate> updates;
+	for (size_t offset = 0; offset + journalRecordHeaderSize <= buff.size();) {
+		const char* record = buff.data() + offset;
+		if (std::memcmp(record, journalRecordMagic, sizeof(journalRecordMagic)) != 0) {
+			break;
+		}
+
+		size_t count = size_t(uint32_t(getInt32(record + 4)));
+		size_t checksumOffset = journalRecordHeaderSize + count * journalUpdateSize;
+		if (offset + checksumOffset + journalChecksumSize > buff.size()
+			|| uint32_t(getInt32(record + checksumOffset)) != checksum(record + 4, checksumOffset - 4)) {
+			break; // запись оборвана сбоем - ее изменения в VFSTable не попадали
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+			const char* update = record + journalRecordHeaderSize + i * journalUpdateSize;
+			updates.push_back(LinkUpdate{ size_t(getInt64(update)), getInt64(update + 8) });
+		}
+		offset += checksumOffset + journalChecksumSize;
+	}
+	return updates;
+}
+
+size_t TestTask::Journal::size() {
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		throw std::runtime_error("Error while reading VFS journal\n");
+	}
+	return size_t(fileStat.st_size);
+}
+
+void TestTask::Journal::reset() {
+
+	std::lock_guard journalGuard(access);
+
+	if (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+		throw std::runtime_error("Error while clearing VFS journal\n");
+	}
+}
+
+#else
+
+TestTask::Journal::Journal(const std::filesystem::path&) {} // без fdatasync журнал ничего не гарантирует - изменения пишутся сразу в VFSTable
+
+TestTask::Journal::~Journal() {}
+
+void TestTask::Journal::commit(const std::vector<LinkUpdate>&) {}
+
+void TestTask::Journal::append(const std::vector<LinkUpdate>&) {}
+
+void TestTask::Journal::sync() {}
+
+std::vector<TestTask::LinkUpdate> TestTask::Journal::replay() { return {}; }
+
+size_t TestTask::Journal::size() { return 0; }
+
+void TestTask::Journal::reset() {}
+
+#endif
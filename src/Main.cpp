@@ -12,7 +12,7 @@ int main() {
 
 	filesys.Write(myfile, message, 10);
 
-	TestTask::File* myfile2 = filesys.Open("test1/test2/test3.txt"); // не откроется, потому что открыли в другом режиме 
+	TestTask::File* myfile2 = filesys.Open("test1/test2/test3.txt"); // откроется снимком: читатель видит файл таким, каким он был при открытии
 
 	TestTask::File* myfile3 = filesys.Create("test1/test2/test4.txt");
 	TestTask::File* myfile4 = filesys.Create("test1/test2/test3.txt"); // еще один "поток" на test3.txt
@@ -0,0 +1,707 @@
+﻿#include "Storage.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/// <summary>
+/// Захват (с ожиданием) или снятие fcntl-блокировки участка файла. Где есть, используются блокировки открытого файла (OFD):
+/// они, в отличие от обычных, не снимаются, когда процесс закрывает другой дескриптор того же файла
+/// </summary>
+/// <param name="fd"> - Дескриптор файла</param>
+/// <param name="type"> - F_RDLCK, F_WRLCK или F_UNLCK</param>
+/// <param name="offset"> - Начало участка</param>
+/// <param name="length"> - Длина участка</param>
+static void lockRegion(int fd, short type, size_t offset, size_t length) {
+
+	struct flock region {};
+	region.l_type = type;
+	region.l_whence = SEEK_SET;
+	region.l_start = off_t(offset);
+	region.l_len = off_t(length);
+
+#ifdef F_OFD_SETLKW
+	int command = F_OFD_SETLKW;
+#else
+	int command = F_SETLKW;
+#endif
+
+	while (fcntl(fd, command, &region) != 0) {
+		if (errno != EINTR) {
+			throw std::runtime_error("Could not lock VFS\n");
+		}
+	}
+}
+
+/// <summary>
+/// Захват fcntl-блокировки участка файла без ожидания
+/// </summary>
+/// <param name="fd"> - Дескриптор файла</param>
+/// <param name="type"> - F_RDLCK или F_WRLCK</param>
+/// <param name="offset"> - Начало участка</param>
+/// <param name="length"> - Длина участка</param>
+/// <returns>false, если участок заблокирован другим владельцем</returns>
+static bool tryLockRegion(int fd, short type, size_t offset, size_t length) {
+
+	struct flock region {};
+	region.l_type = type;
+	region.l_whence = SEEK_SET;
+	region.l_start = off_t(offset);
+	region.l_len = off_t(length);
+
+#ifdef F_OFD_SETLK
+	int command = F_OFD_SETLK;
+#else
+	int command = F_SETLK;
+#endif
+
+	while (fcntl(fd, command, &region) != 0) {
+		if (errno == EAGAIN || errno == EACCES) {
+			return false;
+		}
+		if (errno != EINTR) {
+			throw std::runtime_error("Could not lock VFS\n");
+		}
+	}
+	return true;
+}
+
+#endif
+
+TestTask::StreamStorage::StreamStorage(const std::filesystem::path& path_) : path(path_) {
+
+	stream.open(path, std::ios::in | std::ios::out | std::ios::binary);
+
+	if (!stream.is_open() || stream.bad()) {
+		throw std::runtime_error("Could not open " + path.filename().string() + "\n");
+	}
+}
+
+size_t TestTask::StreamStorage::read(size_t offset, char* buff, size_t len) {
+
+	std::lock_guard streamGuard(access);
+
+	stream.clear();
+	stream.seekg(offset, std::ios::beg);
+	stream.read(buff, len);
+	size_t symbolsRead = size_t(stream.gcount());
+	stream.clear();
+	return symbolsRead;
+}
+
+void TestTask::StreamStorage::write(size_t offset, const char* buff, size_t len) {
+
+	std::lock_guard streamGuard(access);
+
+	if (stream.bad()) {
+		throw std::runtime_error("Error while writing to VFS\n");
+	}
+
+	stream.clear();
+	stream.seekp(offset, std::ios::beg);
+	stream.write(buff, len);
+}
+
+void TestTask::StreamStorage::flush() {
+	std::lock_guard streamGuard(access);
+	stream.flush();
+}
+
+void TestTask::StreamStorage::sync() {
+	flush();
+	syncFile(path); // fstream не умеет fsync - сбрасываем файл через отдельный дескриптор
+}
+
+void TestTask::StreamStorage::truncate(size_t newSize) {
+
+	std::lock_guard streamGuard(access);
+
+	stream.flush();
+	std::filesystem::resize_file(path, newSize);
+	stream.clear();
+}
+
+size_t TestTask::StreamStorage::size() {
+
+	std::lock_guard streamGuard(access);
+
+	stream.clear();
+	stream.seekg(0, std::ios::end);
+	return size_t(stream.tellg());
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+
+TestTask::MappedStorage::MappedStorage(const std::filesystem::path& path, bool chunkedGrowth_) : chunkedGrowth(chunkedGrowth_) {
+
+	fd = ::open(path.c_str(), O_RDWR);
+	if (fd < 0) {
+		throw std::runtime_error("Could not open " + path.filename().string() + "\n");
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0) {
+		::close(fd);
+		throw std::runtime_error("Could not open " + path.filename().string() + "\n");
+	}
+	fileSize = size_t(fileStat.st_size);
+	fileCapacity = fileSize;
+
+	// резервируем адреса с запасом: сначала 1 ТиБ, при отказе - меньше, но не меньше самого файла
+	size_t minimalReserve = (fileSize / mappedChunkSize + 2) * mappedChunkSize;
+	for (reservedSize = size_t(1) << 40; reservedSize >= minimalReserve; reservedSize /= 2) {
+		void* reserved = mmap(nullptr, reservedSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (reserved != MAP_FAILED) {
+			base = static_cast<char*>(reserved);
+			break;
+		}
+	}
+
+	if (!base) {
+		::close(fd);
+		throw std::runtime_error("Could not map " + path.filename().string() + "\n");
+	}
+
+	try {
+		reserve(fileSize);
+	}
+	catch (const std::exception&) {
+		munmap(base, reservedSize);
+		::close(fd);
+		throw;
+	}
+}
+
+TestTask::MappedStorage::~MappedStorage() {
+	msync(base, mappedSize, MS_SYNC);
+	munmap(base, reservedSize);
+	::close(fd);
+}
+
+size_t TestTask::MappedStorage::read(size_t offset, char* buff, size_t len) {
+
+	if (offset + len > fileSize.load()) { // файл мог вырасти в другом процессе
+		refresh();
+	}
+
+	size_t currentSize = fileSize.load();
+	if (offset >= currentSize) {
+		return 0;
+	}
+
+	len = std::min(len, currentSize - offset);
+	std::memcpy(buff, base + offset, len);
+	return len;
+}
+
+/// <summary>
+/// Данные файла без копирования. Отображение не перемещается, поэтому указатель
+/// остается верным, пока существует хранилище
+/// </summary>
+/// <param name="offset"> - Смещение</param>
+/// <param name="len"> - Длина</param>
+/// <returns>Участок отображения (короче len, если файл закончился)</returns>
+std::string_view TestTask::MappedStorage::view(size_t offset, size_t len) {
+
+	if (offset + len > fileSize.load()) {
+		refresh();
+	}
+
+	size_t currentSize = fileSize.load();
+	if (offset >= currentSize) {
+		return {};
+	}
+	return std::string_view(base + offset, std::min(len, currentSize - offset));
+}
+
+void TestTask::MappedStorage::prefetch(size_t offset, size_t len) {
+
+	size_t currentSize = fileSize.load();
+	if (offset >= currentSize || !len) {
+		return;
+	}
+
+	size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	size_t start = offset / pageSize * pageSize;
+	madvise(base + start, std::min(offset + len, currentSize) - start, MADV_WILLNEED); // ОС читает участок в фоне
+}
+
+void TestTask::MappedStorage::write(size_t offset, const char* buff, size_t len) {
+
+	if (offset + len > fileSize.load()) {
+		reserve(offset + len);
+	}
+	std::memcpy(base + offset, buff, len);
+}
+
+void TestTask::MappedStorage::sync() {
+	if (msync(base, mappedSize, MS_SYNC) != 0) {
+		throw std::runtime_error("Error while syncing VFS\n");
+	}
+}
+
+/// <summary>
+/// Расширение данных до newSize байт. Отображение растет крупными участками внутри зарезервированного диапазона;
+/// файл - ровно до нужного размера или, при chunkedGrowth, сразу на участок mappedChunkSize.
+/// Пока хватает запаса, файл не трогается вовсе
+/// </summary>
+/// <param name="newSize"> - Новый конец данных</param>
+void TestTask::MappedStorage::reserve(size_t newSize) {
+
+	std::lock_guard growthGuard(growth);
+
+	if (newSize <= fileCapacity) {
+		mapUpTo(newSize);
+		fileSize = std::max(fileSize.load(), newSize);
+		return;
+	}
+
+	lockRegion(fd, F_WRLCK, 0, 1); // файл растят и другие процессы: без блокировки ftruncate мог бы его укоротить
+
+	try {
+		struct stat fileStat;
+		size_t currentSize = fstat(fd, &fileStat) == 0 ? std::max(fileCapacity, size_t(fileStat.st_size)) : fileCapacity;
+		size_t targetSize = chunkedGrowth ? (newSize + mappedChunkSize - 1) / mappedChunkSize * mappedChunkSize : newSize;
+
+		mapUpTo(std::max(targetSize, currentSize));
+
+		if (targetSize > currentSize) {
+			if (ftruncate(fd, off_t(targetSize)) != 0) {
+				throw std::runtime_error("Could not grow VFS file\n");
+			}
+			currentSize = targetSize;
+		}
+		fileCapacity = currentSize;
+		fileSize = chunkedGrowth ? std::max(fileSize.load(), newSize) : currentSize;
+	}
+	catch (const std::exception&) {
+		lockRegion(fd, F_UNLCK, 0, 1);
+		throw;
+	}
+	lockRegion(fd, F_UNLCK, 0, 1);
+}
+
+size_t TestTask::MappedStorage::size() {
+	refresh();
+	return fileSize.load();
+}
+
+void TestTask::MappedStorage::truncate(size_t newSize) {
+
+	std::lock_guard growthGuard(growth);
+
+	lockRegion(fd, F_WRLCK, 0, 1);
+	int result = ftruncate(fd, off_t(newSize));
+	lockRegion(fd, F_UNLCK, 0, 1);
+
+	if (result != 0) {
+		throw std::runtime_error("Could not shrink VFS file\n");
+	}
+	fileSize = newSize; // при следующем росте reserve снова удлинит файл
+	fileCapacity = newSize;
+}
+
+/// <summary>
+/// Подхват роста файла, сделанного другим процессом: отображение расширяется
+/// до нового размера файла, сам файл не меняется
+/// </summary>
+void TestTask::MappedStorage::refresh() {
+
+	std::lock_guard growthGuard(growth);
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || size_t(fileStat.st_size) <= fileSize.load()) {
+		return;
+	}
+
+	mapUpTo(size_t(fileStat.st_size));
+	fileSize = size_t(fileStat.st_size); // запас, оставленный другим процессом, считается данными - их границы знает VFSTable
+	fileCapacity = std::max(fileCapacity, fileSize.load());
+}
+
+void TestTask::MappedStorage::mapUpTo(size_t newSize) {
+
+	if (newSize > mappedSize || !mappedSize) {
+		size_t target = (newSize / mappedChunkSize + 1) * mappedChunkSize;
+		if (target > reservedSize) {
+			throw std::runtime_error("VFS file is too large to be mapped\n");
+		}
+		void* mapped = mmap(base + mappedSize, target - mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, off_t(mappedSize));
+		if (mapped == MAP_FAILED) {
+			throw std::runtime_error("Could not map VFS file\n");
+		}
+		mappedSize = target;
+	}
+}
+
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+
+TestTask::ProcessLock::ProcessLock(const std::filesystem::path& path) {
+
+	fd = ::open(path.c_str(), O_RDWR);
+	if (fd < 0) {
+		throw std::runtime_error("Could not open " + path.filename().string() + "\n");
+	}
+}
+
+TestTask::ProcessLock::~ProcessLock() {
+	::close(fd);
+}
+
+void TestTask::ProcessLock::lock(size_t offset, size_t length, bool exclusive) {
+	lockRegion(fd, exclusive ? F_WRLCK : F_RDLCK, offset, length);
+}
+
+void TestTask::ProcessLock::unlock(size_t offset, size_t length) {
+	lockRegion(fd, F_UNLCK, offset, length);
+}
+
+bool TestTask::ProcessLock::tryLock(size_t offset, size_t length, bool exclusive) {
+	return tryLockRegion(fd, exclusive ? F_WRLCK : F_RDLCK, offset, length);
+}
+
+#else
+
+TestTask::ProcessLock::ProcessLock(const std::filesystem::path&) {} // без fcntl VFS доступна только одному процессу
+
+TestTask::ProcessLock::~ProcessLock() {}
+
+void TestTask::ProcessLock::lock(size_t, size_t, bool) {}
+
+void TestTask::ProcessLock::unlock(size_t, size_t) {}
+
+bool TestTask::ProcessLock::tryLock(size_t, size_t, bool) { return true; }
+
+#endif
+
+TestTask::CachedStorage::CachedStorage(std::unique_ptr<IStorage> inner_, size_t budget_)
+	: inner(std::move(inner_)), budget(std::max(budget_ / cachePageSize, cacheBypassPages)) {
+	cachedEnd = inner->size();
+}
+
+TestTask::CachedStorage::~CachedStorage() {
+	try {
+		std::lock_guard cacheGuard(access);
+		writeBack();
+	}
+	catch (const std::exception&) { // деструктор не бросает исключений: данные, не попавшие на диск, теряются как при сбое
+	}
+}
+
+size_t TestTask::CachedStorage::read(size_t offset, char* buff, size_t len) {
+
+	std::lock_guard cacheGuard(access);
+
+	if (offset + len > cachedEnd) { // файл мог вырасти в другом процессе
+		cachedEnd = std::max(cachedEnd, inner->size());
+	}
+	if (offset >= cachedEnd) {
+		return 0;
+	}
+	len = std::min(len, cachedEnd - offset);
+
+	if (len > cacheBypassPages * cachePageSize) { // длинное чтение идет напрямую, чтобы не вымывать кэш
+		writeBackRange(offset, len);
+		return inner->read(offset, buff, len);
+	}
+
+	for (size_t done = 0; done < len;) {
+		size_t position = offset + done;
+		size_t inPage = position % cachePageSize;
+		size_t chunk = std::min(cachePageSize - inPage, len - done);
+
+		Page& page = getPage(position / cachePageSize, true);
+		std::memcpy(buff + done, page.data.data() + inPage, chunk);
+		done += chunk;
+	}
+	return len;
+}
+
+void TestTask::CachedStorage::write(size_t offset, const char* buff, size_t len) {
+
+	std::lock_guard cacheGuard(access);
+
+	if (len > cacheBypassPages * cachePageSize) { // длинная запись идет напрямую, но после накопленных - они могли ее перекрывать
+		writeBackRange(offset, len);
+		for (size_t pageNumber = offset / cachePageSize; pageNumber <= (offset + len - 1) / cachePageSize; ++pageNumber) {
+			auto found = pages.find(pageNumber);
+			if (found != pages.end()) {
+				lru.erase(found->second.lruPosition);
+				pages.erase(found);
+			}
+		}
+		inner->write(offset, buff, len);
+		cachedEnd = std::max(cachedEnd, offset + len);
+		return;
+	}
+
+	for (size_t done = 0; done < len;) {
+		size_t position = offset + done;
+		size_t inPage = position % cachePageSize;
+		size_t chunk = std::min(cachePageSize - inPage, len - done);
+
+		Page& page = getPage(position / cachePageSize, chunk != cachePageSize); // страницу, записанную целиком, читать незачем
+		std::memcpy(page.data.data() + inPage, buff + done, chunk);
+
+		if (page.dirtyTo == page.dirtyFrom) {
+			if (!dirtyPages++) {
+				oldestDirty = std::chrono::steady_clock::now();
+			}
+			page.dirtyFrom = inPage;
+			page.dirtyTo = inPage + chunk;
+		}
+		else if (inPage > page.dirtyTo || inPage + chunk < page.dirtyFrom) { // между участками - чужие байты (их мог записать другой процесс): старый участок пишем сразу
+			inner->write(position - inPage + page.dirtyFrom, page.data.data() + page.dirtyFrom, page.dirtyTo - page.dirtyFrom);
+			page.dirtyFrom = inPage;
+			page.dirtyTo = inPage + chunk;
+		}
+		else {
+			page.dirtyFrom = std::min(page.dirtyFrom, inPage);
+			page.dirtyTo = std::max(page.dirtyTo, inPage + chunk);
+		}
+		done += chunk;
+	}
+	cachedEnd = std::max(cachedEnd, offset + len);
+}
+
+void TestTask::CachedStorage::flush() {
+
+	std::lock_guard cacheGuard(access);
+
+	if (dirtyPages >= budget / 2 || (dirtyPages && std::chrono::steady_clock::now() - oldestDirty >= cacheFlushInterval)) {
+		writeBack();
+	}
+}
+
+void TestTask::CachedStorage::publish() {
+	std::lock_guard cacheGuard(access);
+	writeBack();
+}
+
+void TestTask::CachedStorage::sync() {
+	std::lock_guard cacheGuard(access);
+	writeBack();
+	inner->sync();
+}
+
+size_t TestTask::CachedStorage::size() {
+	std::lock_guard cacheGuard(access);
+	cachedEnd = std::max(cachedEnd, inner->size());
+	return cachedEnd;
+}
+
+std::string_view TestTask::CachedStorage::view(size_t offset, size_t len) {
+	std::lock_guard cacheGuard(access);
+	writeBackRange(offset, len); // участок отображения должен содержать и еще не записанные данные
+	return inner->view(offset, len);
+}
+
+void TestTask::CachedStorage::truncate(size_t newSize) {
+
+	std::lock_guard cacheGuard(access);
+
+	writeBack();
+	for (auto page = pages.begin(); page != pages.end();) { // страницы за новым концом больше не нужны
+		if ((page->first + 1) * cachePageSize > newSize) {
+			lru.erase(page->second.lruPosition);
+			page = pages.erase(page);
+		}
+		else {
+			++page;
+		}
+	}
+	inner->truncate(newSize);
+	cachedEnd = newSize;
+}
+
+void TestTask::CachedStorage::invalidate() {
+	std::lock_guard cacheGuard(access);
+	writeBack();
+	pages.clear();
+	lru.clear();
+	cachedEnd = inner->size();
+}
+
+/// <summary>
+/// Подкачка участка в кэш: недостающие страницы, идущие подряд, читаются одним обращением к диску.
+/// За один раз подкачивается не больше четверти кэша
+/// </summary>
+/// <param name="offset"> - Начало участка</param>
+/// <param name="len"> - Длина участка</param>
+void TestTask::CachedStorage::prefetch(size_t offset, size_t len) {
+
+	std::lock_guard cacheGuard(access);
+
+	len = std::min(len, cachedEnd > offset ? cachedEnd - offset : 0);
+	if (!len) {
+		return;
+	}
+
+	size_t lastPage = std::min((offset + len - 1) / cachePageSize, offset / cachePageSize + budget / 4);
+
+	for (size_t pageNumber = offset / cachePageSize; pageNumber <= lastPage;) {
+		if (pages.count(pageNumber)) {
+			++pageNumber;
+			continue;
+		}
+
+		size_t runEnd = pageNumber;
+		while (runEnd < lastPage && !pages.count(runEnd + 1)) {
+			++runEnd;
+		}
+
+		size_t runStart = pageNumber;
+		std::vector<char> buff((runEnd - runStart + 1) * cachePageSize, 0);
+		inner->read(runStart * cachePageSize, buff.data(), buff.size());
+
+		for (; pageNumber <= runEnd; ++pageNumber) {
+			Page& page = getPage(pageNumber, false);
+			std::memcpy(page.data.data(), buff.data() + (pageNumber - runStart) * cachePageSize, cachePageSize);
+		}
+	}
+}
+
+TestTask::CachedStorage::Page& TestTask::CachedStorage::getPage(size_t pageNumber, bool load) {
+
+	auto found = pages.find(pageNumber);
+	if (found != pages.end()) {
+		lru.splice(lru.begin(), lru, found->second.lruPosition);
+		return found->second;
+	}
+
+	while (pages.size() >= budget) {
+		evict();
+	}
+
+	Page& page = pages[pageNumber];
+	page.data.assign(cachePageSize, 0); // за концом файла - нули
+	if (load) {
+		inner->read(pageNumber * cachePageSize, page.data.data(), cachePageSize);
+	}
+	lru.push_front(pageNumber);
+	page.lruPosition = lru.begin();
+	return page;
+}
+
+void TestTask::CachedStorage::evict() {
+
+	size_t victim = lru.back();
+	Page& page = pages[victim];
+
+	if (page.dirtyTo > page.dirtyFrom) { // вытесняемая страница грязная - на диск уходят все грязные страницы одной пачкой
+		writeBack();
+	}
+
+	lru.pop_back();
+	pages.erase(victim);
+}
+
+/// <summary>
+/// Запись грязных страниц в порядке смещений. Грязные участки, идущие вплотную, объединяются в одну запись
+/// </summary>
+void TestTask::CachedStorage::writeBack() {
+
+	if (!dirtyPages) {
+		return;
+	}
+
+	std::vector<size_t> dirty;
+	for (const auto& [pageNumber, page] : pages) {
+		if (page.dirtyTo > page.dirtyFrom) {
+			dirty.push_back(pageNumber);
+		}
+	}
+	std::sort(dirty.begin(), dirty.end());
+
+	std::vector<char> batch;
+	size_t batchOffset = 0;
+
+	for (size_t pageNumber : dirty) {
+		Page& page = pages[pageNumber];
+		size_t pageOffset = pageNumber * cachePageSize + page.dirtyFrom;
+
+		if (batch.empty() || batchOffset + batch.size() != pageOffset) {
+			if (!batch.empty()) {
+				inner->write(batchOffset, batch.data(), batch.size());
+			}
+			batch.clear();
+			batchOffset = pageOffset;
+		}
+		batch.insert(batch.end(), page.data.begin() + page.dirtyFrom, page.data.begin() + page.dirtyTo);
+		page.dirtyFrom = page.dirtyTo = 0;
+	}
+
+	if (!batch.empty()) {
+		inner->write(batchOffset, batch.data(), batch.size());
+	}
+	inner->flush();
+	dirtyPages = 0;
+}
+
+void TestTask::CachedStorage::writeBackRange(size_t offset, size_t len) {
+
+	if (!dirtyPages || !len) {
+		return;
+	}
+
+	for (size_t pageNumber = offset / cachePageSize; pageNumber <= (offset + len - 1) / cachePageSize; ++pageNumber) {
+		auto found = pages.find(pageNumber);
+		if (found != pages.end() && found->second.dirtyTo > found->second.dirtyFrom) {
+			writeBack(); // пишем все грязные страницы сразу: так они уходят на диск по порядку и крупными записями
+			return;
+		}
+	}
+}
+
+/// <summary>
+/// Сброс файла на диск. fsync сбрасывает все данные файла из кэша ОС, через какой бы дескриптор они ни были записаны
+/// </summary>
+/// <param name="path"> - Путь к файлу</param>
+void TestTask::syncFile(const std::filesystem::path& path) {
+
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Could not open " + path.filename().string() + "\n");
+	}
+	int result = fsync(fd);
+	::close(fd);
+	if (result != 0) {
+		throw std::runtime_error("Error while syncing VFS\n");
+	}
+#else
+	(void)path; // без POSIX данные остаются в кэше ОС
+#endif
+}
+
+/// <summary>
+/// Открытие файла VFS
+/// </summary>
+/// <param name="path"> - Путь к файлу</param>
+/// <param name="backend"> - Способ доступа</param>
+/// <param name="cacheSize"> - Бюджет кэша страниц в байтах (0 - без кэша)</param>
+/// <param name="chunkedGrowth"> - Размер файла ничего не значит, и его можно растить с запасом</param>
+/// <returns>Хранилище</returns>
+std::unique_ptr<TestTask::IStorage> TestTask::openStorage(const std::filesystem::path& path, StorageBackend backend, size_t cacheSize, bool chunkedGrowth) {
+
+#if defined(__unix__) || defined(__APPLE__)
+	if (backend == StorageBackend::Mapped) {
+		return std::make_unique<MappedStorage>(path, chunkedGrowth); // отображение и так работает через страничный кэш ОС - свой кэш не нужен
+	}
+#endif
+	if (cacheSize) {
+		return std::make_unique<CachedStorage>(std::make_unique<StreamStorage>(path), cacheSize);
+	}
+	return std::make_unique<StreamStorage>(path); // без mmap работаем через fstream
+}
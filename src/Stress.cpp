@@ -0,0 +1,175 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TextFS.h"
+
+// Многопоточная нагрузочная проверка: Read и Write на 1, 2, 4, ... потоках (до количества ядер) на обоих бэкендах.
+// Каждый поток пишет и читает свой файл, затем все потоки читают один общий файл. Все прочитанное сверяется
+// с записанным: при расхождении - код возврата 1. Скорость растет с числом потоков, если File разных файлов
+// и читатели одного файла друг друга не ждут.
+// Запуск: TestTaskStress [мегабайт на поток] [наибольшее число потоков]
+
+static const size_t chunkSize = 4096; // столько байт за один вызов Read или Write
+
+static char pattern(size_t stream, size_t offset) { // содержимое файла потока stream
+	return char('a' + (offset + stream * 7) % 26);
+}
+
+static double megabytesPerSecond(size_t bytes, std::chrono::steady_clock::duration elapsed) {
+	double seconds = std::chrono::duration<double>(elapsed).count();
+	return seconds > 0 ? double(bytes) / seconds / double(1 << 20) : 0;
+}
+
+/// <summary>
+/// Запуск threadCount потоков и ожидание их завершения
+/// </summary>
+/// <param name="threadCount"> - Количество потоков</param>
+/// <param name="work"> - Работа потока, получает его номер</param>
+/// <returns>Время от запуска первого потока до завершения последнего</returns>
+static std::chrono::steady_clock::duration runThreads(size_t threadCount, const std::function<void(size_t)>& work) {
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < threadCount; ++i) {
+		threads.emplace_back(work, i);
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	return std::chrono::steady_clock::now() - start;
+}
+
+/// <summary>
+/// Запись файла потока по кускам chunkSize
+/// </summary>
+/// <returns>false, если записалось не все</returns>
+static bool writeFile(TestTask::textFS& fs, const std::string& name, size_t stream, size_t fileSize) {
+
+	TestTask::File* f = fs.Create(name.c_str());
+	if (!f) {
+		return false;
+	}
+
+	std::vector<char> buff(chunkSize);
+	size_t written = 0;
+	while (written < fileSize) {
+		size_t len = std::min(chunkSize, fileSize - written);
+		for (size_t i = 0; i < len; ++i) {
+			buff[i] = pattern(stream, written + i);
+		}
+		size_t result = fs.Write(f, buff.data(), len);
+		written += result;
+		if (result != len) {
+			break;
+		}
+	}
+	fs.Close(f);
+	return written == fileSize;
+}
+
+/// <summary>
+/// Чтение файла потока по кускам chunkSize со сверкой содержимого
+/// </summary>
+/// <returns>false, если прочитано не все или не то</returns>
+static bool readFile(TestTask::textFS& fs, const std::string& name, size_t stream, size_t fileSize) {
+
+	TestTask::File* f = fs.Open(name.c_str());
+	if (!f) {
+		return false;
+	}
+
+	std::vector<char> buff(chunkSize);
+	size_t symbolsRead = 0;
+	bool valid = true;
+	while (valid) {
+		size_t result = fs.Read(f, buff.data(), chunkSize);
+		if (!result) {
+			break;
+		}
+		for (size_t i = 0; i < result && valid; ++i) {
+			valid = buff[i] == pattern(stream, symbolsRead + i);
+		}
+		symbolsRead += result;
+	}
+	fs.Close(f);
+	return valid && symbolsRead == fileSize;
+}
+
+/// <summary>
+/// Один замер: threadCount потоков пишут, читают свои файлы и читают общий файл в свежей VFS
+/// </summary>
+/// <returns>false, если данные разошлись</returns>
+static bool measure(TestTask::StorageBackend backend, const std::string& backendName, size_t threadCount, size_t fileSize) {
+
+	std::filesystem::path VFSPath("stress_" + backendName);
+	std::filesystem::remove_all(VFSPath);
+	std::filesystem::create_directory(VFSPath); // VFS создается в самой глубокой существующей папке пути
+
+	TestTask::VFSOptions options;
+	options.clusterSize = TestTask::pageClusterSize;
+	options.backend = backend;
+	options.compactionRate = 0; // фоновый перенос исказил бы замер
+	TestTask::textFS fs(options);
+
+	auto fileName = [&VFSPath](size_t stream) { return (VFSPath / ("t" + std::to_string(stream)) / "data.bin").string(); };
+
+	std::vector<char> valid(threadCount, 0); // vector<bool> нельзя писать из разных потоков
+
+	std::chrono::steady_clock::duration writeTime = runThreads(threadCount, [&](size_t stream) {
+		valid[stream] = writeFile(fs, fileName(stream), stream, fileSize);
+	});
+
+	std::chrono::steady_clock::duration readTime = runThreads(threadCount, [&](size_t stream) {
+		valid[stream] = valid[stream] && readFile(fs, fileName(stream), stream, fileSize);
+	});
+
+	std::chrono::steady_clock::duration sharedTime = runThreads(threadCount, [&](size_t stream) { // читатели одного файла
+		valid[stream] = valid[stream] && readFile(fs, fileName(0), 0, fileSize);
+	});
+
+	bool allValid = std::all_of(valid.begin(), valid.end(), [](char v) { return v != 0; });
+	size_t totalBytes = threadCount * fileSize;
+
+	std::cout << std::setw(8) << backendName << std::setw(9) << threadCount << std::fixed << std::setprecision(1)
+		<< std::setw(13) << megabytesPerSecond(totalBytes, writeTime)
+		<< std::setw(13) << megabytesPerSecond(totalBytes, readTime)
+		<< std::setw(15) << megabytesPerSecond(totalBytes, sharedTime)
+		<< (allValid ? "" : "   DATA MISMATCH") << std::endl;
+
+	return allValid;
+}
+
+int main(int argc, char* argv[]) {
+
+	size_t fileSize = (argc > 1 ? std::max(1, std::stoi(argv[1])) : 16) * (size_t(1) << 20);
+	size_t maxThreads = argc > 2 ? size_t(std::max(1, std::stoi(argv[2]))) : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+	std::vector<size_t> threadCounts;
+	for (size_t count = 1; count < maxThreads; count *= 2) {
+		threadCounts.push_back(count);
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::vector<std::pair<TestTask::StorageBackend, std::string>> backends = { { TestTask::StorageBackend::Stream, "stream" } };
+#if defined(__unix__) || defined(__APPLE__)
+	backends.emplace_back(TestTask::StorageBackend::Mapped, "mapped");
+#endif
+
+	std::cout << "backend  threads  write MB/s   read MB/s  shared MB/s" << std::endl;
+
+	bool allValid = true;
+	for (const auto& [backend, backendName] : backends) {
+		for (size_t threadCount : threadCounts) {
+			allValid = measure(backend, backendName, threadCount, fileSize) && allValid;
+		}
+		std::filesystem::remove_all("stress_" + backendName);
+	}
+	return allValid ? 0 : 1;
+}
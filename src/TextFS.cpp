@@ -2,30 +2,18 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <iomanip>
 #include <exception>
+#include <algorithm>
+#include <cstring>
 
-TestTask::File::File(std::filesystem::path VFSpath_, std::string filePath_, FileStatus status_)
-	: filePath(filePath_), status(status_) {
+TestTask::File::File(std::shared_ptr<VFSMount> mount_, std::string filePath_, FileStatus status_)
+	: mount(mount_), filePath(filePath_), status(status_) {
 
-	VFSHeader.open(VFSpath_ / VFSHeaderFileName, std::ios::in | std::ios::out | std::ios::binary);
-	VFSTable.open(VFSpath_ / VFSTableFileName, std::ios::in | std::ios::out | std::ios::binary);
-	VFSData.open(VFSpath_ / VFSDataFileName, std::ios::in | std::ios::out | std::ios::binary);
-
-	if (VFSHeader.bad() || VFSTable.bad() || VFSData.bad()) {
-		VFSHeader.close();
-		VFSTable.close();
-		VFSData.close();
+	if (!mount) {
 		throw std::runtime_error("Could not open VFS\n");
 	}
 }
 
-TestTask::File::~File() {
-	VFSHeader.close();
-	VFSTable.close();
-	VFSData.close();
-}
-
 TestTask::File::operator bool() {
 	return bool(clusterSize);
 }
@@ -34,79 +22,22 @@ TestTask::File::operator bool() {
 /// Завершение созднания File
 /// </summary>
 /// <param name="clusterSize_"> - Размер кластера в VFS </param>
-/// <param name="firstCluster_"> - Первый кластер файла</param>
-void TestTask::File::finInit(int clusterSize_, int firstCluster_) {
+/// <param name="firstCluster_"> - Первый кластер файла (отрицательный - у файла нет кластеров)</param>
+/// <param name="recordNumber_"> - Номер записи о файле</param>
+void TestTask::File::finInit(size_t clusterSize_, int64_t firstCluster_, size_t recordNumber_) {
 	clusterSize = clusterSize_;
+	recordNumber = recordNumber_;
 	firstCluster = firstCluster_;
 	currentCluster = firstCluster_;
 }
 
-struct VFSInfo { // структура, в которую будут записываться данные о VFS
-	operator bool() { return clusterSize > 0 && FirstEmptyCluster >= 0; }
-	int clusterSize = -1;
-	int FirstEmptyCluster = -1;
-};
-
-struct FileInfo { // структура, в которую будут записываться данные о файле (из VFSHeader)
-	std::string fileName;
-	int firstCluster = -1;
-	std::string mode;
-	int numberOfThreads = 0;
-
-	FileInfo(const std::string fileName_) : fileName(fileName_) {};
-
-	FileInfo(const std::string fileName_, int firstCluster_, std::string mode_, int numberOfThreads) : 
-		fileName(fileName_) , firstCluster(firstCluster_), mode(mode_),numberOfThreads(numberOfThreads) {};
-
-};
-
-std::ostream& operator<<(std::ostream& os, const FileInfo& info) {
-	os << info.fileName << " ";
-	os << std::setw(TestTask::maxClusterDigits) << std::setfill('0') << info.firstCluster;
-	os << ' ' << info.mode + std::string(TestTask::maxModeMarkLength - info.mode.length(), ' ');
-	os << ' ' << std::setw(TestTask::maxThreadsCounterLength) << std::setfill('0') << info.numberOfThreads;
-	os << '\n';
-	return os;
-}
-
-std::istream& operator>>(std::istream& is, FileInfo& info) {
-
-	std::string buff;
-	std::getline(is, buff);
-
-	buff = buff.substr(info.fileName.length() + 1, buff.length());
-
-	try {
-		info.firstCluster = std::stoi(buff);
-	}
-	catch (const std::exception& e) {
-		std::cerr << e.what();
-		info.firstCluster = TestTask::faultyCluster;
-	}
-
-	buff = buff.substr(TestTask::maxClusterDigits + 1, buff.length());
-	info.mode = buff.substr(0, TestTask::maxModeMarkLength);
-
-	try {
-		info.numberOfThreads = std::stoi(buff.substr(TestTask::maxModeMarkLength, buff.length()));
-		// будет равен 0 только если файл не открыт в каком-либо режиме (нет метки режима или количество потоков = 0)
-	}
-	catch (const std::exception& e) {
-		std::cerr << e.what();
-		info.numberOfThreads = 0;
-	}
-	return is;
-}
-
 /// <summary>
 /// Инициализация VFS
 /// </summary>
 /// <param name="filePath"> - Путь к файлу</param>
+/// <param name="clusterSize"> - Размер кластера новой VFS</param>
 /// <returns>Путь к папке с VFS</returns>
-std::filesystem::path VFSInit(const std::string& filePath) { 
-
-	std::lock_guard headerGuard(TestTask::VFSHeaderAccess);// блокикуем VFS
-	std::lock_guard tableGuard(TestTask::VFSTableAccess);
+std::filesystem::path VFSInit(const std::string& filePath, size_t clusterSize) { 
 
 	std::filesystem::path VFSPath(filePath);
 
@@ -114,20 +45,27 @@ std::filesystem::path VFSInit(const std::string& filePath) {
 		VFSPath = VFSPath.parent_path();
 	}
 	
-	std::ofstream serviceStream;     // создаем три файла, которые необходимы для работы VFS
-	serviceStream.open(VFSPath / TestTask::VFSHeaderFileName, std::ios::binary);  // в Header записываем данные о VFS
-	serviceStream << TestTask::clusterSizeMark + std::string(TestTask::maxSettingLength - TestTask::clusterSizeMark.length(), ' ');
-	serviceStream << std::setw(TestTask::maxClusterDigits) << std::setfill('0') << TestTask::defaultClusterSize << '\n';
-	serviceStream << TestTask::firstEmptyClusterMark + std::string(TestTask::maxSettingLength - TestTask::firstEmptyClusterMark.length(), ' ');
-	serviceStream << std::setw(TestTask::maxClusterDigits) << std::setfill('0') << 0 << '\n';
-	serviceStream << TestTask::endOfVFSInfo << '\n';
+	char buff[TestTask::superBlockSize];
+
+	std::ofstream serviceStream;     // создаем файлы, которые необходимы для работы VFS
+	serviceStream.open(VFSPath / TestTask::VFSHeaderFileName, std::ios::binary);  // в Header записываем суперблок с данными о VFS
+	TestTask::VFSInfo info;
+	info.clusterSize = int64_t(clusterSize);
+	info.serialize(buff);
+	serviceStream.write(buff, TestTask::superBlockSize);
 	serviceStream.close();
 
 	serviceStream.open(VFSPath / TestTask::VFSTableFileName, std::ios::binary); // в Table записываем данные о первом кластере (первый кластер пустой)
-	serviceStream << "-" << std::setw(TestTask::maxClusterDigits - 1) << std::setfill('0') << std::abs(TestTask::clusterIsEmpty) << '\n';
+	TestTask::putInt64(buff, TestTask::clusterIsEmpty);
+	serviceStream.write(buff, TestTask::tableEntrySize);
+	serviceStream.close();
+
+	serviceStream.open(VFSPath / TestTask::VFSBitmapFileName, std::ios::binary); // в Bitmap первый кластер отмечен свободным
+	buff[0] = 0;
+	serviceStream.write(buff, 1);
 	serviceStream.close();
 
-	serviceStream.open(VFSPath / TestTask::VFSDataFileName, std::ios::binary); // Data файл остается пустым
+	serviceStream.open(VFSPath / TestTask::VFSDataFileName, std::ios::binary); // Data файл остается пустым; он создается последним, поэтому findVFSPath не увидит VFS недописанной
 	serviceStream.close();
 
 	return VFSPath;
@@ -145,9 +83,6 @@ std::filesystem::path findVFSPath(const std::string& filePath) {
 	if (VFSPath.empty())
 		throw std::runtime_error("Empty path to VFS\n");
 
-	std::lock_guard headerGuard(TestTask::VFSHeaderAccess);// блокикуем VFS
-	std::lock_guard tableGuard(TestTask::VFSTableAccess);
-
 	while (VFSPath != VFSPath.root_path()) { // в filePath ищем папку, в которой инициализирована VFS
 		VFSPath = VFSPath.parent_path();
 		if (std::filesystem::exists(VFSPath / TestTask::VFSHeaderFileName) &&
@@ -166,364 +101,454 @@ std::filesystem::path findVFSPath(const std::string& filePath) {
 }
 
 /// <summary>
-/// Получение информации о VFS из VFSHeader
+/// Поиск следующего кластера
 /// </summary>
 /// <param name="f"> - File</param>
-/// <returns>VFSInfo</returns>
-VFSInfo getVFSInfo(TestTask::File* f) {
+/// <returns>Номер следующего кластера (endOfFile для читателя, дошедшего до конца своего снимка)</returns>
+int64_t findNextCluster(TestTask::File* f) {
 
 	if (!f) {
 		throw  std::runtime_error("Trying to get info from an empty File\n");
 	}
 
-	if (f->VFSHeader.bad()) {
-		throw  std::runtime_error("Error while working with VFS header\n");
+	if (f->clusterIndex + 1 >= f->snapshotClusters) { // кластеры, дописанные после открытия, читателю не видны
+		return TestTask::endOfFile;
 	}
 
-	std::lock_guard headerGuard(TestTask::VFSHeaderAccess); 
+	return f->mount->clusterTable.getNext(f->currentCluster);
+}
 
-	f->VFSHeader.clear();
-	f->VFSHeader.seekg(0, std::ios_base::beg);
+/// <summary>
+/// Следующий участок VFSData, который прочитает File, со сдвигом позиции File за него.
+/// Кластеры цепочки, идущие в VFSData подряд, дают один участок
+/// </summary>
+/// <param name="f"> - File</param>
+/// <param name="len"> - Сколько байт осталось прочитать</param>
+/// <returns>Участок: first - смещение в VFSData, length - длина (0, если файл закончился - статус File уже выставлен)</returns>
+TestTask::Extent nextReadSegment(TestTask::File* f, size_t len) {
 
-	std::string buff;
-	VFSInfo info;
-	
-	std::getline(f->VFSHeader, buff);
-	while (buff.find(TestTask::endOfVFSInfo) == std::string::npos && !f->VFSHeader.eof()) { // Параметры VFS могут лежать в Header в любом порядке
+	size_t clusterSize = f->getClusterSize();
 
-		if (buff.find(TestTask::clusterSizeMark) != std::string::npos) {
-			try {
-				info.clusterSize = std::stoi(buff.substr(TestTask::maxSettingLength, buff.length()));
-			}
-			catch (const std::exception&) {
-				std::cerr << "Error while working with VFS Header\n";
-			}
+	size_t position = f->clusterIndex * clusterSize + f->indicatorPosition;
+	if (position >= f->fileLength) { // дальше - хвост последнего кластера, а не данные файла
+		f->setEOFStatus();
+		return {};
+	}
+	len = std::min(len, f->fileLength - position);
+
+	if (f->indicatorPosition >= clusterSize) { // текущий кластер прочитан - переходим к следующему
+		int64_t nextCluster = findNextCluster(f);
+		if (nextCluster == TestTask::endOfFile) {
+			f->setEOFStatus();
+			return {};
 		}
-		else if (buff.find(TestTask::firstEmptyClusterMark) != std::string::npos) {
-			try {
-				info.FirstEmptyCluster = std::stoi(buff.substr(TestTask::maxSettingLength,buff.length()));
-			}
-			catch (const std::exception&) {
-				std::cerr << "Error while working with VFS Header\n";
-			}
+		if (nextCluster < 0) {
+			f->setBadStatus();
+			return {};
 		}
-		std::getline(f->VFSHeader, buff);
+		f->currentCluster = nextCluster;
+		f->indicatorPosition = 0;
+		++f->clusterIndex;
 	}
 
-	return info;
+	size_t clustersNeeded = (f->indicatorPosition + len + clusterSize - 1) / clusterSize;
+	clustersNeeded = std::min(clustersNeeded, f->snapshotClusters - f->clusterIndex);
+	TestTask::Extent run = f->mount->clusterTable.getRun(f->currentCluster, clustersNeeded);
+	size_t textLength = std::min(run.length * clusterSize - f->indicatorPosition, len);
+
+	TestTask::Extent segment{ f->currentCluster * clusterSize + f->indicatorPosition, textLength };
+
+	size_t runPosition = f->indicatorPosition + textLength;
+	f->currentCluster = run.first + (runPosition - 1) / clusterSize;
+	f->indicatorPosition = runPosition - (f->currentCluster - run.first) * clusterSize;
+	f->clusterIndex += f->currentCluster - run.first;
+	return segment;
 }
 
 /// <summary>
-/// Поиск начального кластера файла и отметка об открытии File
+/// То же для файла без кластеров: участок его данных, скопированных в File при открытии
 /// </summary>
 /// <param name="f"> - File</param>
-/// <param name="mode"> - режим, в котором будет открыт файл</param>
-/// <returns>Номер начального кластера файла</returns>
-int openFileThread(TestTask::File* f, const std::string& mode) {
-	
-	if (f->VFSHeader.bad()) {
-		throw  std::runtime_error("Error while working with VFS header\n");
+/// <param name="len"> - Сколько байт осталось прочитать</param>
+/// <returns>Участок: first - смещение в f->inlineData, length - длина (0, если файл закончился)</returns>
+TestTask::Extent inlineReadSegment(TestTask::File* f, size_t len) {
+
+	size_t position = f->indicatorPosition;
+	if (position >= f->fileLength) {
+		f->setEOFStatus();
+		return {};
 	}
 
-	std::lock_guard headerGuard(TestTask::VFSHeaderAccess);// блокикуем VFS
-
-	f->VFSHeader.clear();
-	f->VFSHeader.seekg(0, std::ios_base::beg);
+	TestTask::Extent segment{ position, std::min(len, f->fileLength - position) };
+	f->indicatorPosition += segment.length;
+	return segment;
+}
 
-	std::string buff;
-	int pointerPos = 0;
-	FileInfo info(f->getFilePath());
+/// <summary>
+/// Достраивание индекса цепочки File до count кластеров (не дальше конца цепочки или снимка читателя)
+/// </summary>
+/// <param name="f"> - File</param>
+/// <param name="count"> - Сколько первых кластеров цепочки нужно</param>
+/// <returns>Сколько кластеров в индексе теперь</returns>
+size_t extendChainIndex(TestTask::File* f, size_t count) {
 
-	while (std::getline(f->VFSHeader, buff)) { // ищем нужный файл в header
-		if (buff.find(f->getFilePath()) != std::string::npos) { // нашли
-			
-			f->VFSHeader.seekg(pointerPos, std::ios_base::beg);
-			f->VFSHeader >> info;
+	std::vector<size_t>& index = f->chainIndex;
+	if (index.empty()) {
+		index.push_back(f->getFirstCluster());
+	}
 
-			if (info.numberOfThreads && buff.find(mode) == std::string::npos) { // если с данным файлом работает хоть один поток в другом режиме
-				throw  std::runtime_error("File was already opened in opposing to " + mode + " mode\n");
-			}
-			else { // либо совпал режим, либо количество рабочих потоков -  ноль
-				if (++info.numberOfThreads >TestTask::maxThreadsCount) {
-					throw  std::runtime_error("Too many threads for one file\n");
-				}
-				f->VFSHeader.clear();
-				f->VFSHeader.seekp(pointerPos, std::ios_base::beg);
-				f->VFSHeader << info; // перед этим увеличилии количество рабочих потоков (см. несколько строк выше)
-				f->VFSHeader.flush();
-				return info.firstCluster;
-			}
+	count = std::min(count, f->snapshotClusters);
+	while (index.size() < count) { // цепочка проходится только от последнего известного кластера
+		int64_t nextCluster = f->mount->clusterTable.getNext(index.back());
+		if (nextCluster == TestTask::endOfFile) {
+			break;
 		}
-		pointerPos = f->VFSHeader.tellp();
+		if (nextCluster < 0) {
+			throw std::runtime_error("Broken cluster chain: " + f->getFilePath() + "\n");
+		}
+		index.push_back(size_t(nextCluster));
 	}
-
-	return TestTask::didNotFindCluster; // в том случае, если не нашли файл в VFSHeader
+	return index.size();
 }
 
 /// <summary>
-/// Отметка о закрытии File
+/// Участки VFSData, на которые ложится участок файла (по индексу цепочки, без курсора File)
 /// </summary>
 /// <param name="f"> - File</param>
-void closeFileThread(TestTask::File*f ) { 
-
-	if (!f || !*f) {
-		return;
-	}
-
-	if (f->VFSHeader.bad()) {
-		throw  std::runtime_error("Error while working with VFS header\n");
+/// <param name="offset"> - Начало участка от начала файла</param>
+/// <param name="len"> - Длина участка</param>
+/// <returns>Участки: first - смещение в VFSData, length - длина; соседние в VFSData склеены. Обрываются там, где кончается цепочка</returns>
+std::vector<TestTask::Extent> fileSegments(TestTask::File* f, size_t offset, size_t len) {
+
+	std::vector<TestTask::Extent> segments;
+	if (!len) {
+		return segments;
 	}
 
-	std::lock_guard headerGuard(TestTask::VFSHeaderAccess);// блокикуем VFS
-
-	f->VFSHeader.clear();
-	f->VFSHeader.seekp(0, std::ios_base::beg);
-	f->VFSHeader.seekg(0, std::ios_base::beg);
-
-	std::string buff;
-	int pointerPos = 0;
-	FileInfo info(f->getFilePath());
-
-	while (std::getline(f->VFSHeader, buff)) { // ищем нужный файл в header
-		if (buff.find(f->getFilePath()) != std::string::npos) {
+	size_t clusterSize = f->getClusterSize();
+	size_t firstCluster = offset / clusterSize;
+	size_t lastCluster = (offset + len - 1) / clusterSize;
 
-			f->VFSHeader.seekg(pointerPos, std::ios_base::beg);
-			f->VFSHeader >> info;
+	std::lock_guard indexGuard(f->indexAccess);
+	size_t endCluster = std::min(lastCluster + 1, extendChainIndex(f, lastCluster + 1));
 
-			--info.numberOfThreads;
+	for (size_t clusterNumber = firstCluster; clusterNumber < endCluster; ++clusterNumber) {
+		size_t from = clusterNumber == firstCluster ? offset % clusterSize : 0;
+		size_t to = std::min(clusterSize, offset + len - clusterNumber * clusterSize);
+		size_t dataOffset = f->chainIndex[clusterNumber] * clusterSize + from;
 
-			f->VFSHeader.clear();
-			f->VFSHeader.seekp(pointerPos, std::ios_base::beg);
-			f->VFSHeader << info;
-			f->VFSHeader.flush();
-			return;
+		if (!segments.empty() && segments.back().first + segments.back().length == dataOffset) {
+			segments.back().length += to - from;
+		}
+		else {
+			segments.push_back(TestTask::Extent{ dataOffset, to - from });
 		}
-		pointerPos = f->VFSHeader.tellp();
 	}
+	return segments;
 }
 
 /// <summary>
-/// Поиск самого ближнего к from свободного кластера 
+/// Установка курсора File на позицию (cursorAccess взята)
 /// </summary>
-/// <param name="f"> - file</param>
-/// <param name="from"> - С какого кластера начинать поиск</param>
-/// <returns>Номер свободного кластера</returns>
-int findEmptyCluster(TestTask::File* f, int from = 0) { 
+/// <param name="f"> - File</param>
+/// <param name="position"> - Позиция от начала файла (не дальше его конца)</param>
+/// <returns>false, если цепочка короче позиции</returns>
+bool moveCursor(TestTask::File* f, size_t position) {
+
+	if (f->inlined) { // у файла без кластеров курсор - просто позиция
+		f->clusterIndex = 0;
+		f->indicatorPosition = position;
+		f->resetEOFStatus();
+		return true;
+	}
 
-	if (!f) {
-		throw  std::runtime_error("Trying to get info from an empty File\n");
+	size_t clusterSize = f->getClusterSize();
+	size_t clusterNumber = position / clusterSize;
+	size_t inClusterPosition = position % clusterSize;
+	if (clusterNumber && !inClusterPosition) { // граница кластеров: встаем в конец предыдущего, следующего может еще не быть
+		--clusterNumber;
+		inClusterPosition = clusterSize;
 	}
 
-	if (f->VFSTable.bad()) {
-		throw  std::runtime_error("Error while working with VFS table\n");
+	std::lock_guard indexGuard(f->indexAccess);
+	if (extendChainIndex(f, clusterNumber + 1) <= clusterNumber) {
+		return false;
 	}
 
-	std::lock_guard tableGuard(TestTask::VFSTableAccess);// блокируем VFS
+	f->currentCluster = f->chainIndex[clusterNumber];
+	f->indicatorPosition = inClusterPosition;
+	f->clusterIndex = clusterNumber;
+	f->readAheadWindow = 0; // окно растет заново, когда File снова начнут читать подряд (lastReadEnd)
+	f->prefetchedUntil = 0;
+	f->resetEOFStatus();
+	return true;
+}
 
-	f->VFSTable.clear();
-	f->VFSTable.seekg(0, std::ios_base::beg);
-	f->VFSTable.seekp(0, std::ios_base::beg);
-	
-	int clusterStatus = 0;
-	int currentLine = 0;
-	std::string buff;
+/// <summary>
+/// Проверка, пишет ли File по-прежнему в запись о файле. Если файл уже перенес в кластеры другой писатель
+/// или он перестает помещаться в запись, File переходит на кластеры с той же позицией курсора
+/// (курсор, блокировка писателей файла и блокировка записи взяты)
+/// </summary>
+/// <param name="f"> - File</param>
+/// <param name="end"> - До какой позиции File собирается писать</param>
+/// <returns>true, если данные File остаются в записи</returns>
+bool keepInline(TestTask::File* f, size_t end) {
 
-	while (!f->VFSTable.eof()) {
-		
-		f->VFSTable >> clusterStatus;
+	if (!f->inlined) {
+		return false;
+	}
 
-		if (currentLine > from) {
-				if (clusterStatus == TestTask::clusterIsEmpty)
-				return currentLine;
+	int64_t firstCluster = f->mount->firstCluster(f->getRecordNumber());
+	if (firstCluster < 0) {
+		if (end <= f->mount->getInlineLimit()) {
+			return true;
 		}
-		++currentLine;
+		firstCluster = f->mount->promoteFile(f->getRecordNumber());
 	}
-	
-	f->VFSTable.seekp(0, std::ios_base::end);
-	f->VFSTable.clear();
-	f->VFSTable << "-" << std::setw(TestTask::maxClusterDigits - 1) << std::setfill('0') << std::abs(TestTask::clusterIsEmpty) << '\n';
-	f->VFSTable.flush();
 
-	return currentLine;
+	size_t position = f->indicatorPosition;
+	{
+		std::lock_guard indexGuard(f->indexAccess);
+		f->chainIndex.clear();
+		f->finInit(f->getClusterSize(), firstCluster, f->getRecordNumber());
+		f->inlined = false;
+	}
+	if (!moveCursor(f, position)) {
+		throw std::runtime_error("Broken cluster chain: " + f->getFilePath() + "\n");
+	}
+	return false;
 }
 
 /// <summary>
-/// Обновление информации в Header 
+/// Запись с явной позиции по индексу цепочки. Недостающие в конце кластеры выделяются одним разом
+/// (блокировка писателей файла взята)
 /// </summary>
 /// <param name="f"> - File</param>
-/// <param name="info"> - Информация для записи</param>
-void refreshVFSHeader(TestTask::File* f, const VFSInfo& info) {
-	// пока что обновляется только позиция первого свободного кластера
-	// с расширением возможностей VFS можно обновлять и другие данные
+/// <param name="offset"> - Позиция от начала файла (не дальше его конца)</param>
+/// <param name="buff"> - Что записать</param>
+/// <param name="len"> - Сколько байт записать</param>
+/// <returns>Сколько байт записано</returns>
+size_t writeAt(TestTask::File* f, size_t offset, const char* buff, size_t len) {
 
-	if (!f) {
-		throw  std::runtime_error("Trying to get info from an empty File\n");
-	}
+	f->mount->refreshClusterTable(); // другой процесс мог дописать этот файл
 
-	if (f->VFSHeader.bad()) {
-		throw  std::runtime_error("Error while working with VFS header\n");
+	if (offset > f->mount->fileLength(f->getRecordNumber())) { // дыр в файлах нет
+		return 0;
 	}
 
-	std::lock_guard headerGuard(TestTask::VFSHeaderAccess);// блокикуем VFS
-
-	f->VFSHeader.clear();
-	f->VFSHeader.seekp(0, std::ios_base::beg);
-	f->VFSHeader.seekg(0, std::ios_base::beg);
+	if (keepInline(f, offset + len)) {
+		f->mount->writeInline(f->getRecordNumber(), offset, buff, len);
+		f->mount->extendFileLength(f->getRecordNumber(), offset + len);
+		return len;
+	}
 
-	std::string buff;
-	int pointerPos = 0;
-	
-	while (buff.find(TestTask::endOfVFSInfo) == std::string::npos && !f->VFSHeader.eof() && std::getline(f->VFSHeader, buff)) {
-
-		if (buff.find(TestTask::firstEmptyClusterMark) != std::string::npos) { // работает - не чини
-			f->VFSHeader.seekp(pointerPos, std::ios::beg);
-			f->VFSHeader << TestTask::firstEmptyClusterMark + std::string(TestTask::maxSettingLength - TestTask::firstEmptyClusterMark.length(), ' ');
-			f->VFSHeader << std::setw(TestTask::maxClusterDigits) << std::setfill('0') << info.FirstEmptyCluster;
-			f->VFSHeader << '\n';
-			f->VFSHeader.flush();
-			break;
+	size_t clusterSize = f->getClusterSize();
+	size_t clustersNeeded = (offset + len + clusterSize - 1) / clusterSize;
+	{
+		std::lock_guard indexGuard(f->indexAccess);
+		size_t clusters = extendChainIndex(f, clustersNeeded);
+		if (clusters < clustersNeeded) { // индекс дошел до хвоста цепочки - к нему и привязываем новые кластеры
+			for (const TestTask::Extent& extent : f->mount->allocateChain(int64_t(f->chainIndex.back()), clustersNeeded - clusters)) {
+				for (size_t cluster = extent.first; cluster < extent.first + extent.length; ++cluster) {
+					f->chainIndex.push_back(cluster);
+				}
+			}
 		}
-		pointerPos = f->VFSHeader.tellp();
- 	}
+	}
+
+	size_t symbolsWritten = 0;
+	for (const TestTask::Extent& segment : fileSegments(f, offset, len)) {
+		f->mount->VFSData->write(segment.first, buff + symbolsWritten, segment.length);
+		symbolsWritten += segment.length;
+	}
+	f->mount->VFSData->flush();
+	f->mount->extendFileLength(f->getRecordNumber(), offset + symbolsWritten);
+	return symbolsWritten;
 }
 
-/// <summary>
-/// Переназначение ссылки на следующий кластер
-/// </summary>
-/// <param name="f"> - File</param>
-/// <param name="clusterNumber"> - Откуда ссылаемся</param>
-/// <param name="changeTo"> - Куда ссылаемся</param>
-void changeClusterAssigment(TestTask::File* f, int clusterNumber, int changeTo) {
+// Курсор по набору буферов ReadV/WriteV: выдает их кусками по мере того, как они ложатся на участки VFSData
+class BufferCursor {
+public:
+	BufferCursor(const TestTask::IOBuffer* buffers_, size_t count_) : buffers(buffers_), count(count_) {}
 
-	if (clusterNumber < 0) {
-		throw  std::runtime_error("Invalid cluster number\n");
+	size_t total() {
+		size_t length = 0;
+		for (size_t i = 0; i < count; ++i) {
+			length += buffers[i].length;
+		}
+		return length;
 	}
 
-	if (!f) {
-		throw  std::runtime_error("Trying to get info from an empty File\n");
-	}
+	TestTask::IOBuffer next(size_t length) { // следующий кусок не длиннее length
+		while (index < count && position == buffers[index].length) { // пустые и уже пройденные буферы пропускаем
+			++index;
+			position = 0;
+		}
+		if (index == count) {
+			return {};
+		}
 
-	if (f->VFSTable.bad()) {
-		throw  std::runtime_error("Error while working with VFS table\n");
+		TestTask::IOBuffer piece{ buffers[index].data + position, std::min(length, buffers[index].length - position) };
+		position += piece.length;
+		return piece;
 	}
 
-	std::lock_guard tableGuard(TestTask::VFSTableAccess); // блокируем VFS
+private:
+	const TestTask::IOBuffer* buffers;
 
-	f->VFSTable.clear();
-	f->VFSTable.seekp(0, std::ios_base::beg);
-	f->VFSTable.seekg(0, std::ios_base::beg);
+	size_t count;
 
-	int currentCluster = 0;
-	int pointerPos = 0;
-	std::string buff;
+	size_t index = 0; // текущий буфер
 
-	while (std::getline(f->VFSTable,buff)) {
-		
-		int currentAssigment = std::stoi(buff);
+	size_t position = 0; // позиция в текущем буфере
+};
 
-		if (currentCluster == clusterNumber) {
-			f->VFSTable.seekp(pointerPos, std::ios::beg);
-			f->VFSTable.clear();
+/// <summary>
+/// Запись участка VFSData из набора буферов
+/// </summary>
+/// <param name="storage"> - VFSData</param>
+/// <param name="offset"> - Начало участка</param>
+/// <param name="cursor"> - Буферы; сдвигаются за записанные байты</param>
+/// <param name="len"> - Длина участка</param>
+void writeBuffers(TestTask::IStorage& storage, size_t offset, BufferCursor& cursor, size_t len) {
+
+	while (len) {
+		TestTask::IOBuffer piece = cursor.next(len);
+		storage.write(offset, piece.data, piece.length);
+		offset += piece.length;
+		len -= piece.length;
+	}
+}
 
-			if (changeTo >= 0) {
-				f->VFSTable << std::setw(TestTask::maxClusterDigits) << std::setfill('0') << changeTo << '\n';
-			}
-			else {
-				f->VFSTable << "-" << std::setw(TestTask::maxClusterDigits - 1) << std::setfill('0') << std::abs(changeTo) << '\n';
-			}
-			f->VFSTable.flush();
+/// <summary>
+/// Чтение участка VFSData в набор буферов
+/// </summary>
+/// <param name="storage"> - VFSData</param>
+/// <param name="offset"> - Начало участка</param>
+/// <param name="cursor"> - Буферы; сдвигаются за прочитанные байты</param>
+/// <param name="len"> - Длина участка</param>
+/// <returns>Сколько байт удалось прочитать</returns>
+size_t readBuffers(TestTask::IStorage& storage, size_t offset, BufferCursor& cursor, size_t len) {
+
+	size_t symbolsRead = 0;
+	while (symbolsRead < len) {
+		TestTask::IOBuffer piece = cursor.next(len - symbolsRead);
+		size_t textLength = storage.read(offset + symbolsRead, piece.data, piece.length);
+		symbolsRead += textLength;
+		if (textLength < piece.length) {
 			break;
 		}
-		++currentCluster;
-		pointerPos = f->VFSTable.tellp();
-	}
-
-	if (currentCluster == clusterNumber && f->VFSTable.eof() && changeTo == TestTask::clusterIsEmpty) { // если нужно проставить метку пустого кластера в конец файла 
-		f->VFSTable.clear();
-		f->VFSTable.seekp(0, std::ios::end);
-		f->VFSTable << "-" << std::setw(TestTask::maxClusterDigits - 1) << std::setfill('0') << std::abs(TestTask::clusterIsEmpty) << '\n';
-		f->VFSTable.flush();
-	}
-
-	if (currentCluster < clusterNumber) {
-		throw  std::runtime_error("Error while changing cluster assigment\n");
 	}
+	return symbolsRead;
 }
 
 /// <summary>
-/// Поиск следующего кластера
+/// Копирование данных из памяти в набор буферов (данные файла без кластеров)
 /// </summary>
-/// <param name="f"> - File</param>
-/// <returns>Номер следующего кластера</returns>
-int findNextCluster(TestTask::File* f) {
-
-	if (!f) {
-		throw  std::runtime_error("Trying to get info from an empty File\n");
+/// <param name="data"> - Откуда</param>
+/// <param name="cursor"> - Буферы; сдвигаются за скопированные байты</param>
+/// <param name="len"> - Сколько байт</param>
+void copyToBuffers(const char* data, BufferCursor& cursor, size_t len) {
+
+	for (size_t copied = 0; copied < len;) {
+		TestTask::IOBuffer piece = cursor.next(len - copied);
+		std::memcpy(piece.data, data + copied, piece.length);
+		copied += piece.length;
 	}
+}
 
-	if (f->VFSTable.bad()) {
-		throw  std::runtime_error("Error while working with VFS table\n");
-	}
+TestTask::textFS::textFS(VFSOptions options_) : options(options_) {
 
-	std::lock_guard tableGuard(TestTask::VFSTableAccess);
+	if (options.clusterSize == 0 || options.clusterSize > maxClusterSize) {
+		throw std::invalid_argument("Invalid VFS cluster size\n");
+	}
+}
 
-	f->VFSTable.clear();
-	f->VFSTable.seekp(0, std::ios_base::beg);
-	f->VFSTable.seekg(0, std::ios_base::beg);
+/// <summary>
+/// Подключение VFS. Файлы VFS открываются и разбираются только при первом обращении к VFS
+/// </summary>
+/// <param name="VFSPath"> - Путь к папке с VFS</param>
+/// <returns>Общая для всех File данной VFS подключенная VFS</returns>
+std::shared_ptr<TestTask::VFSMount> TestTask::textFS::mountVFS(const std::filesystem::path& VFSPath) {
 
-	int clusterAssigment = 0;
-	int currentLine = 0;
+	std::filesystem::path key = std::filesystem::weakly_canonical(VFSPath.empty() ? "." : VFSPath);
 
-	while (!f->VFSTable.eof()) {
+	std::lock_guard mountsGuard(mountsAccess);
 
-		f->VFSTable >> clusterAssigment;
+	std::shared_ptr<VFSMount>& mount = mounts[key];
+	if (!mount) {
+		if (isTextVFS(VFSPath)) { // VFS, созданная старой версией, переводится в бинарный формат при первом обращении
+			convertTextVFS(VFSPath);
+		}
+		mount = std::make_shared<VFSMount>(VFSPath, options.backend, options.cacheSize, options.compactionRate, options.inlineThreshold);
+	}
+	return mount;
+}
 
-		if (currentLine == f->currentCluster) {
-				return clusterAssigment;
+/// <summary>
+/// Поиск VFS, в которой лежит файл. Найденная папка запоминается для директории файла,
+/// и следующие Open и Create в той же директории не проверяют файловую систему.
+/// Ненайденные VFS не запоминаются - ее может создать Create
+/// </summary>
+/// <param name="filePath"> - Путь к файлу</param>
+/// <returns>Папка VFS (didNotFindVFS, если ее нет)</returns>
+std::filesystem::path TestTask::textFS::resolveVFS(const std::string& filePath) {
+
+	std::filesystem::path directory = std::filesystem::path(filePath).parent_path();
+	{
+		std::lock_guard rootsGuard(VFSRootsAccess);
+		auto found = VFSRoots.find(directory);
+		if (found != VFSRoots.end()) {
+			return found->second;
 		}
-		++currentLine;
 	}
 
-	return TestTask::didNotFindCluster;
+	std::filesystem::path VFSPath = findVFSPath(filePath);
+	if (VFSPath != TestTask::didNotFindVFS) {
+		std::lock_guard rootsGuard(VFSRootsAccess);
+		VFSRoots[directory] = VFSPath;
+	}
+	return VFSPath;
 }
 
 /// <summary>
-/// Добавление файла в VFS
+/// Открытие File в подключенной VFS
 /// </summary>
-/// <param name="f"> - File</param>
-/// <param name="mode"> - Режим, в котором будет открыт файл</param>
-/// <returns>Номер первого кластера файла</returns>
-int addFileToVFS(TestTask::File* f, const std::string& mode) { // добавляем файл в VFS
+/// <param name="VFSPath"> - Путь к папке с VFS</param>
+/// <param name="filePath"> - "Фиктивный" путь к файлу</param>
+/// <param name="status"> - Режим, в котором будет открыт файл</param>
+/// <returns>File или nullptr, если файл не удалось открыть</returns>
+TestTask::File* TestTask::textFS::openFile(const std::filesystem::path& VFSPath, const std::string& filePath, FileStatus status) {
 
 	try {
-		
-		VFSInfo info = getVFSInfo(f);
+		std::shared_ptr<VFSMount> mount = mountVFS(VFSPath);
 
-		int currentEmptyCluster = info.FirstEmptyCluster;
-		int nextEmptyCluster = findEmptyCluster(f, info.FirstEmptyCluster);
-		info.FirstEmptyCluster = nextEmptyCluster;
-
-		refreshVFSHeader(f, info);
-		changeClusterAssigment(f, currentEmptyCluster, TestTask::endOfFile);
-		changeClusterAssigment(f, nextEmptyCluster, TestTask::clusterIsEmpty);
-
-		if (f->VFSHeader.bad()) {
-			throw  std::runtime_error("Error while working with VFS header\n");
+		bool create = status == FileStatus::WriteOnly;
+		size_t recordNumber = 0;
+		std::vector<char> inlineData;
+		int64_t fileCluster = mount->openFile(filePath, create ? WriteOnlyMark : ReadOnlyMark, create, recordNumber, create ? nullptr : &inlineData);
+		if (fileCluster == TestTask::didNotFindCluster) {
+			return nullptr;
 		}
 
-		std::lock_guard headerGuard(TestTask::VFSHeaderAccess);// блокикуем VFS (важно делать после refreshVFSHeader)
-
-		f->VFSHeader.clear();
-		f->VFSHeader.seekp(0, std::ios_base::end);
-		FileInfo fileInfo(f->getFilePath(), currentEmptyCluster, mode, 1);
-		
-		f->VFSHeader << fileInfo;
-		f->VFSHeader.flush();
-
-		return currentEmptyCluster;
+		File* file = new File(mount, filePath, status);
+		file->finInit(mount->getClusterSize(), fileCluster, recordNumber);
+		file->fileAccess = &mount->fileLock(recordNumber);
+		file->inlined = fileCluster < 0;
+		if (!create && file->inlined) { // данные маленького файла прочитаны вместе с его записью, без цепочки
+			file->inlineData = std::move(inlineData);
+			file->fileLength = file->inlineData.size();
+		}
+		else if (!create) {
+			file->fileLength = mount->fileLength(recordNumber); // снимок: длина на момент открытия; цепочка не бывает короче нее
+			size_t clusterSize = mount->getClusterSize();
+			file->snapshotClusters = std::max<size_t>(1, (file->fileLength + clusterSize - 1) / clusterSize); // кластеры за длиной читателю не нужны - цепочку не обходим
+		}
+		return file;
 	}
-	catch (const std::exception&) {
-		throw;
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return nullptr;
 	}
 }
 
@@ -533,7 +558,7 @@ TestTask::File* TestTask::textFS::Open(const char* name) {
 	std::filesystem::path VFSPath;
 	
 	try {
-		VFSPath = findVFSPath(filePath);
+		VFSPath = resolveVFS(filePath);
 	}
 	catch (const std::exception& e) {
 		std::cerr << e.what();
@@ -544,127 +569,243 @@ TestTask::File* TestTask::textFS::Open(const char* name) {
 		return nullptr;
 	}
 
-	File* file = new File(VFSPath,filePath,FileStatus::ReadOnly);
+	return openFile(VFSPath, filePath, FileStatus::ReadOnly);
+}
 
-	VFSInfo info = getVFSInfo(file);
+TestTask::File* TestTask::textFS::Create(const char* name) {
 
-	if (!info) {
-		return nullptr;
-	}
+	std::string filePath(name);
+	std::filesystem::path VFSPath;
 
 	try {
-		int fileCluster = openFileThread(file, ReadOnlyMark);
-		if (fileCluster == TestTask::didNotFindCluster ) {
-			delete file;
-			return nullptr;
-		}
-		file->finInit(info.clusterSize, fileCluster);
+		VFSPath = resolveVFS(filePath);
 	}
 	catch (const std::exception& e) {
 		std::cerr << e.what();
-		delete file;
 		return nullptr;
 	}
-	
-	return file;
+
+	if (VFSPath == TestTask::didNotFindVFS) {
+		std::lock_guard initGuard(VFSInitAccess); // VFS создается один раз, даже если ее одновременно создают несколько потоков
+		VFSPath = resolveVFS(filePath);
+		if (VFSPath == TestTask::didNotFindVFS) {
+			VFSPath = VFSInit(filePath, options.clusterSize);
+		}
+	}
+
+	return openFile(VFSPath, filePath, FileStatus::WriteOnly);
 }
 
-TestTask::File* TestTask::textFS::Create(const char* name) {
+size_t TestTask::textFS::Read(File* f, char* buff, size_t len) {
+	IOBuffer buffer{ buff, len };
+	return ReadV(f, &buffer, 1);
+}
 
-	std::string filePath(name);
-	std::filesystem::path VFSPath;
+size_t TestTask::textFS::ReadV(File* f, const IOBuffer* buffers, size_t count) {
+
+	if (!f || !buffers) {
+		return 0;
+	}
+
+	if (f->getStatus()!=FileStatus::ReadOnly) {
+		return 0;
+	}
+
+	std::lock_guard cursorGuard(f->cursorAccess); // блокировку файла читатель не берет - он читает свой снимок
+
+	BufferCursor cursor(buffers, count);
+	size_t len = cursor.total();
+	size_t symbolsRead = 0;
+	bool sequential = f->clusterIndex * f->getClusterSize() + f->indicatorPosition == f->lastReadEnd; // после Seek в сторону подкачивать нечего
 
 	try {
-		VFSPath = findVFSPath(filePath);
+		while (symbolsRead < len) {
+			if (f->inlined) {
+				Extent segment = inlineReadSegment(f, len - symbolsRead);
+				if (!segment.length) {
+					break;
+				}
+				copyToBuffers(f->inlineData.data() + segment.first, cursor, segment.length);
+				symbolsRead += segment.length;
+				continue;
+			}
+
+			if (sequential) {
+				readAhead(f);
+			}
+
+			Extent segment = nextReadSegment(f, len - symbolsRead);
+			if (!segment.length) {
+				break;
+			}
+
+			size_t textLength = readBuffers(*f->mount->VFSData, segment.first, cursor, segment.length); // идущие подряд кластеры - один проход
+			symbolsRead += textLength;
+			if (textLength < segment.length) { // VFSData короче цепочки - дальше читать нечего
+				break;
+			}
+		}
 	}
 	catch (const std::exception& e) {
 		std::cerr << e.what();
-		return nullptr;
 	}
+	f->lastReadEnd = f->clusterIndex * f->getClusterSize() + f->indicatorPosition;
+	return symbolsRead;
+}
 
-	if (VFSPath == TestTask::didNotFindVFS) {
-		VFSPath = VFSInit(filePath);
+/// <summary>
+/// Чтение с явной позицией. Курсор File не меняется, блокировки File не берутся (кроме короткой - на индекс цепочки)
+/// </summary>
+/// <param name="f"> - File</param>
+/// <param name="offset"> - Позиция от начала файла</param>
+/// <param name="buff"> - Куда читать</param>
+/// <param name="len"> - Сколько байт прочитать</param>
+/// <returns>Сколько байт удалось прочитать</returns>
+size_t TestTask::textFS::PRead(File* f, size_t offset, char* buff, size_t len) {
+
+	if (!f) {
+		return 0;
 	}
 
-	File* file = new File(VFSPath, filePath, FileStatus::WriteOnly);
+	FileStatus status = f->getStatus();
+	if (status != FileStatus::ReadOnly && status != FileStatus::EndOfFile) { // конец файла для курсора PRead не мешает
+		return 0;
+	}
 
-	VFSInfo info = getVFSInfo(file);
+	if (offset >= f->fileLength) {
+		return 0;
+	}
+	len = std::min(len, f->fileLength - offset);
 
-	if (!info) {
-		return nullptr;
+	if (f->inlined) {
+		std::memcpy(buff, f->inlineData.data() + offset, len);
+		return len;
 	}
 
-	try {
-		int fileCluster = openFileThread(file, TestTask::WriteOnlyMark);
+	size_t symbolsRead = 0;
 
-		if (fileCluster == TestTask::didNotFindCluster) {
-			fileCluster = addFileToVFS(file, TestTask::WriteOnlyMark);
+	try {
+		for (const Extent& segment : fileSegments(f, offset, len)) {
+			size_t textLength = f->mount->VFSData->read(segment.first, buff + symbolsRead, segment.length);
+			symbolsRead += textLength;
+			if (textLength < segment.length) {
+				break;
+			}
 		}
-		file->finInit(info.clusterSize, fileCluster);
 	}
 	catch (const std::exception& e) {
 		std::cerr << e.what();
-		delete file;
-		return nullptr;
 	}
-
-	return file;
+	return symbolsRead;
 }
 
-size_t TestTask::textFS::Read(File* f, char* buff, size_t len) {
+/// <summary>
+/// Запись с явной позицией. Курсор File не меняется
+/// </summary>
+/// <param name="f"> - File</param>
+/// <param name="offset"> - Позиция от начала файла (не дальше его конца)</param>
+/// <param name="buff"> - Что записать</param>
+/// <param name="len"> - Сколько байт записать</param>
+/// <returns>Сколько байт удалось записать</returns>
+size_t TestTask::textFS::PWrite(File* f, size_t offset, char* buff, size_t len) {
 
-	if (!f || f->VFSData.bad()) {
+	if (!f || !len) {
 		return 0;
 	}
 
-	if (f->getStatus()!=FileStatus::ReadOnly) {
+	if (f->getStatus() != FileStatus::WriteOnly) {
 		return 0;
 	}
 
-	size_t clusterSize = f->getClusterSize();
-	size_t maxLength = clusterSize - f->indicatorPosition; // максимальное количество символов, которое может поместиться в текущий кластер
-	size_t textLength = maxLength >= len ? len : maxLength;
+	std::lock_guard cursorGuard(f->cursorAccess); // позиция курсора не меняется, но при переходе File на кластеры пересчитывается
+	std::lock_guard fileGuard(*f->fileAccess);
+	ProcessLockGuard recordGuard(f->mount->processLock, superBlockSize + f->getRecordNumber() * fileRecordSize, fileRecordSize, true);
+
+	try {
+		return writeAt(f, offset, buff, len);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return 0;
+	}
+}
 
-	f->VFSData.seekg(f->currentCluster * clusterSize + f->indicatorPosition, std::ios::beg);
-	f->VFSData.read(buff, textLength);
-	size_t symbolsRead = textLength;
-	f->indicatorPosition += symbolsRead;
+std::vector<std::string_view> TestTask::textFS::ReadView(File* f, size_t len) {
 
-	while (symbolsRead < len) {
+	std::vector<std::string_view> views;
 
-		try {
-			f->currentCluster = findNextCluster(f);
-			f->indicatorPosition = 0;
+	if (!f || f->getStatus() != FileStatus::ReadOnly) {
+		return views;
+	}
+
+	std::lock_guard cursorGuard(f->cursorAccess);
+
+	if (f->inlined) { // данные файла без кластеров уже в File - один участок
+		if (!len) {
+			return views;
+		}
+		Extent segment = inlineReadSegment(f, len);
+		if (segment.length) {
+			views.emplace_back(f->inlineData.data() + segment.first, segment.length);
+		}
+		if (segment.length < len) {
+			inlineReadSegment(f, len - segment.length); // как и для цепочки: конец файла отмечается сразу
+		}
+		return views;
+	}
+
+	std::vector<Extent> segments; // участки VFSData в байтах: first - смещение, length - длина
+	size_t symbolsViewed = 0;
+	bool sequential = f->clusterIndex * f->getClusterSize() + f->indicatorPosition == f->lastReadEnd;
 
-			if (f->currentCluster == TestTask::endOfFile) {
-				f->setEOFStatus();
+	try {
+		while (symbolsViewed < len) {
+			if (sequential) {
+				readAhead(f);
 			}
-			else
-			if (f->currentCluster == TestTask::didNotFindCluster ||
-				f->currentCluster == TestTask::faultyCluster) {
 
-				f->setBadStatus();
+			Extent segment = nextReadSegment(f, len - symbolsViewed);
+			if (!segment.length) {
 				break;
 			}
+			segments.push_back(segment);
+			symbolsViewed += segment.length;
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+	}
+	f->lastReadEnd = f->clusterIndex * f->getClusterSize() + f->indicatorPosition;
 
-			f->VFSData.seekg(f->currentCluster * clusterSize + f->indicatorPosition, std::ios::beg);
-			maxLength = clusterSize;
-			textLength = clusterSize >= len - symbolsRead ? len - symbolsRead : clusterSize;
-
-			f->VFSData.read(buff + symbolsRead, textLength);
-			symbolsRead += textLength;
-			f->indicatorPosition += symbolsRead;
+	if (f->mount->VFSData->canView()) {
+		for (const Extent& segment : segments) {
+			std::string_view view = f->mount->VFSData->view(segment.first, segment.length);
+			if (!view.empty()) {
+				views.push_back(view);
+			}
 		}
-		catch (const std::exception& e) {
-			std::cerr << e.what();
-			break;
+		return views;
+	}
+
+	f->viewBuffer.resize(symbolsViewed); // VFSData не отображен в память - копируем один раз в буфер File
+	size_t buffPosition = 0;
+	for (const Extent& segment : segments) {
+		size_t symbolsRead = f->mount->VFSData->read(segment.first, f->viewBuffer.data() + buffPosition, segment.length);
+		if (symbolsRead) {
+			views.emplace_back(f->viewBuffer.data() + buffPosition, symbolsRead);
 		}
+		buffPosition += segment.length;
 	}
-	return symbolsRead;
+	return views;
 }
 
 size_t TestTask::textFS::Write(File* f, char* buff, size_t len) {
-	if (!f) {
+	IOBuffer buffer{ buff, len };
+	return WriteV(f, &buffer, 1);
+}
+
+size_t TestTask::textFS::WriteV(File* f, const IOBuffer* buffers, size_t count) {
+	if (!f || !buffers) {
 		return 0;
 	}
 
@@ -672,54 +813,91 @@ size_t TestTask::textFS::Write(File* f, char* buff, size_t len) {
 		return 0;
 	}
 
-	size_t clusterSize = f->getClusterSize();
-	f->VFSData.seekp(f->currentCluster * clusterSize + f->indicatorPosition, std::ios::beg);
+	std::lock_guard cursorGuard(f->cursorAccess);
+	std::lock_guard fileGuard(*f->fileAccess); // писатели одного файла идут по одному: иначе оба привяжут цепочки к одному хвосту
+	ProcessLockGuard recordGuard(f->mount->processLock, superBlockSize + f->getRecordNumber() * fileRecordSize, fileRecordSize, true); // в том числе из разных процессов
+
+	f->mount->refreshClusterTable(); // другой процесс мог дописать этот файл
+
+	BufferCursor cursor(buffers, count);
+	size_t len = cursor.total();
 
+	try {
+		if (keepInline(f, f->indicatorPosition + len)) { // файл по-прежнему помещается в свою запись
+			for (size_t symbolsWritten = 0; symbolsWritten < len;) {
+				IOBuffer piece = cursor.next(len - symbolsWritten);
+				f->mount->writeInline(f->getRecordNumber(), f->indicatorPosition + symbolsWritten, piece.data, piece.length);
+				symbolsWritten += piece.length;
+			}
+			f->indicatorPosition += len;
+			f->mount->extendFileLength(f->getRecordNumber(), f->indicatorPosition); // и делает данные видимыми
+			return len;
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return 0;
+	}
+
+	size_t clusterSize = f->getClusterSize();
 	size_t maxLength = clusterSize - f->indicatorPosition; // максимальное количество символов, которое может поместиться в текущий кластер
 	size_t textLength = maxLength >= len ? len : maxLength;
 
-	f->VFSData.write(buff, textLength);
+	writeBuffers(*f->mount->VFSData, f->currentCluster * clusterSize + f->indicatorPosition, cursor, textLength); // сначала дописываем текущий кластер
 	size_t symbolsWritten = textLength;
 	f->indicatorPosition += symbolsWritten;
 
 	while (symbolsWritten < len) {
 		try {
-			int nextCluster = findNextCluster(f);
-			if (nextCluster == TestTask::endOfFile) { // если все кластеры под данный файл закончились, то выделяем новый
-
-				VFSInfo info = getVFSInfo(f);
-
-				int currentEmptyCluster = info.FirstEmptyCluster;
-				int nextEmptyCluster = findEmptyCluster(f, info.FirstEmptyCluster);
-				info.FirstEmptyCluster = nextEmptyCluster;
-
-				refreshVFSHeader(f, info);
-				changeClusterAssigment(f, f->currentCluster, currentEmptyCluster); // с текущего ссылаемся на только что выделенный
-				changeClusterAssigment(f, currentEmptyCluster, TestTask::endOfFile); // только что выделенный помечаем как конец файла
-				changeClusterAssigment(f, nextEmptyCluster, TestTask::clusterIsEmpty); // следующий пустой кластер помечаем как пустой
-				nextCluster = currentEmptyCluster;
+			size_t clustersNeeded = (len - symbolsWritten + clusterSize - 1) / clusterSize;
+			std::vector<Extent> extents;
+
+			int64_t nextCluster = findNextCluster(f);
+			if (nextCluster == TestTask::endOfFile) { // если все кластеры под данный файл закончились, то выделяем сразу все недостающие
+				extents = f->mount->allocateChain(f->currentCluster, clustersNeeded);
+
+				std::lock_guard indexGuard(f->indexAccess);
+				if (f->chainIndex.size() == f->clusterIndex + 1) { // индекс доходил до хвоста - продлеваем его новыми кластерами
+					for (const Extent& extent : extents) {
+						for (size_t cluster = extent.first; cluster < extent.first + extent.length; ++cluster) {
+							f->chainIndex.push_back(cluster);
+						}
+					}
+				}
 			}
-			else if (nextCluster == TestTask::didNotFindCluster) { // не нашли следующий кластер
+			else if (nextCluster < 0) { // не нашли следующий кластер
 				break;
 			}
+			else { // перезаписываем уже принадлежащие файлу кластеры, идущие подряд
+				extents.push_back(f->mount->clusterTable.getRun(nextCluster, clustersNeeded));
+			}
 
-			f->currentCluster = nextCluster;
-			f->indicatorPosition = 0;
+			for (const Extent& extent : extents) { // каждый непрерывный участок записывается одной операцией
+				textLength = std::min(extent.length * clusterSize, len - symbolsWritten);
 
-			f->VFSData.seekp(f->currentCluster * clusterSize + f->indicatorPosition, std::ios::beg);
-			maxLength = clusterSize;
-			textLength = clusterSize >= len - symbolsWritten ? len - symbolsWritten : clusterSize;
+				writeBuffers(*f->mount->VFSData, extent.first * clusterSize, cursor, textLength);
+				symbolsWritten += textLength;
 
-			f->VFSData.write(buff + symbolsWritten, textLength);
-			symbolsWritten += textLength;
-			f->indicatorPosition += textLength;
+				f->currentCluster = extent.first + (textLength - 1) / clusterSize;
+				f->indicatorPosition = textLength - (f->currentCluster - extent.first) * clusterSize;
+				f->clusterIndex += 1 + f->currentCluster - extent.first; // участок начинается со следующего по цепочке кластера
+			}
 		}
 		catch (const std::exception& e) {
 			std::cerr << e.what();
 			break;
 		}
 	}
-	f->VFSData.flush();
+	f->mount->VFSData->flush();
+
+	try {
+		if (symbolsWritten) {
+			f->mount->extendFileLength(f->getRecordNumber(), f->clusterIndex * clusterSize + f->indicatorPosition); // после данных: читатель не увидит длину раньше них
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+	}
 	return symbolsWritten;
 }
 
@@ -729,12 +907,34 @@ void TestTask::textFS::Close(File* f) {
 		return;
 	}
 
+	IOEngine* started = startedEngine.load(std::memory_order_acquire);
+	if (started && !started->runsQueueOf(f)) { // очередь File выполняется по порядку - пустая задача в ее конце дожидается всех предыдущих
+		started->submitFuture(f, []() {}).wait();
+	}
+
+	releaseFile(f);
+}
+
+void TestTask::textFS::releaseFile(File* f) {
+
+	if (!f) {
+		return;
+	}
+
+	const std::string& mode = f->getStatus() == FileStatus::WriteOnly ? WriteOnlyMark : ReadOnlyMark;
+
+	if (f->getStatus() == FileStatus::WriteOnly) {
+		Sync(f);
+	}
+
 	f->currentCluster = f->getFirstCluster();
 	f->setClosedStatus();
 	f->indicatorPosition = 0;
 
 	try {
-		closeFileThread(f);
+		if (*f) {
+			f->mount->closeFile(f->getRecordNumber(), mode);
+		}
 		delete f;
 	}
 	catch (const std::exception& e) {
@@ -742,3 +942,263 @@ void TestTask::textFS::Close(File* f) {
 		return;
 	}
 };
+
+std::future<size_t> TestTask::textFS::ReadAsync(File* f, char* buff, size_t len) {
+	return engine().submitFuture(f, [this, f, buff, len]() { return Read(f, buff, len); });
+}
+
+std::future<size_t> TestTask::textFS::WriteAsync(File* f, char* buff, size_t len) {
+	return engine().submitFuture(f, [this, f, buff, len]() { return Write(f, buff, len); });
+}
+
+void TestTask::textFS::ReadAsync(File* f, char* buff, size_t len, std::function<void(size_t)> onComplete) {
+	engine().submit(f, [this, f, buff, len, onComplete]() { onComplete(Read(f, buff, len)); });
+}
+
+void TestTask::textFS::WriteAsync(File* f, char* buff, size_t len, std::function<void(size_t)> onComplete) {
+	engine().submit(f, [this, f, buff, len, onComplete]() { onComplete(Write(f, buff, len)); });
+}
+
+TestTask::IOAwaitable<TestTask::File*> TestTask::textFS::co_open(const char* name) {
+	return IOAwaitable<File*>(engine(), name, [this, filePath = std::string(name)]() { return Open(filePath.c_str()); });
+}
+
+TestTask::IOAwaitable<TestTask::File*> TestTask::textFS::co_create(const char* name) {
+	return IOAwaitable<File*>(engine(), name, [this, filePath = std::string(name)]() { return Create(filePath.c_str()); });
+}
+
+TestTask::IOAwaitable<size_t> TestTask::textFS::co_read(File* f, char* buff, size_t len) {
+	return IOAwaitable<size_t>(engine(), f, [this, f, buff, len]() { return Read(f, buff, len); });
+}
+
+TestTask::IOAwaitable<size_t> TestTask::textFS::co_write(File* f, char* buff, size_t len) {
+	return IOAwaitable<size_t>(engine(), f, [this, f, buff, len]() { return Write(f, buff, len); });
+}
+
+TestTask::IOAwaitable<void> TestTask::textFS::co_close(File* f) {
+	return IOAwaitable<void>(engine(), f, [this, f]() { releaseFile(f); }); // предыдущие операции File уже выполнены - они раньше в той же очереди
+}
+
+/// <summary>
+/// Упреждающее чтение: когда File подходит к концу уже подкачанной части цепочки, следующие кластеры
+/// подкачиваются заранее, а окно удваивается. Если пул потоков уже запущен, подкачка идет в нем
+/// </summary>
+/// <param name="f"> - File, который читают подряд</param>
+void TestTask::textFS::readAhead(File* f) {
+
+	if (f->clusterIndex + f->readAheadWindow / 2 < f->prefetchedUntil) { // впереди еще достаточно подкачанных кластеров
+		return;
+	}
+
+	size_t clusterSize = f->getClusterSize();
+	size_t maxWindow = std::clamp(readAheadMaxBytes / clusterSize, readAheadMinClusters, readAheadMaxClusters);
+	f->readAheadWindow = f->readAheadWindow ? std::min(f->readAheadWindow * 2, maxWindow) : readAheadMinClusters;
+
+	size_t from = std::max(f->prefetchedUntil, f->clusterIndex + 1);
+	size_t to = std::min(f->clusterIndex + 1 + f->readAheadWindow, f->snapshotClusters);
+
+	std::vector<Extent> segments; // участки VFSData в байтах
+	int64_t cluster = int64_t(f->currentCluster);
+	for (size_t index = f->clusterIndex + 1; index < to; ++index) {
+		cluster = f->mount->clusterTable.getNext(size_t(cluster));
+		if (cluster < 0) {
+			break;
+		}
+		if (index < from) {
+			continue;
+		}
+
+		size_t offset = size_t(cluster) * clusterSize;
+		if (!segments.empty() && segments.back().first + segments.back().length == offset) {
+			segments.back().length += clusterSize;
+		}
+		else {
+			segments.push_back(Extent{ offset, clusterSize });
+		}
+	}
+	f->prefetchedUntil = std::max(f->prefetchedUntil, to);
+
+	if (segments.empty()) {
+		return;
+	}
+
+	std::shared_ptr<VFSMount> mount = f->mount; // File могут закрыть раньше, чем закончится подкачка
+	auto prefetch = [mount, segments]() {
+		for (const Extent& segment : segments) {
+			mount->VFSData->prefetch(segment.first, segment.length);
+		}
+	};
+
+	IOEngine* started = startedEngine.load(std::memory_order_acquire);
+	if (started) {
+		started->submit(mount.get(), prefetch);
+	}
+	else {
+		prefetch();
+	}
+}
+
+TestTask::IOEngine& TestTask::textFS::engine() {
+	std::call_once(ioEngineStarted, [this]() {
+		ioEngine = std::make_unique<IOEngine>(options.ioThreads);
+		startedEngine.store(ioEngine.get(), std::memory_order_release);
+	});
+	return *ioEngine;
+}
+
+void TestTask::textFS::Sync(File* f) {
+
+	if (!f) {
+		return;
+	}
+
+	try {
+		f->mount->sync();
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+	}
+}
+
+/// <summary>
+/// Перемещение курсора File
+/// </summary>
+/// <param name="f"> - File</param>
+/// <param name="offset"> - Смещение в байтах</param>
+/// <param name="origin"> - Откуда отсчитывается смещение</param>
+/// <returns>Новая позиция от начала файла или -1, если она вне файла (тогда курсор не меняется)</returns>
+int64_t TestTask::textFS::Seek(File* f, int64_t offset, SeekOrigin origin) {
+
+	if (!f) {
+		return -1;
+	}
+
+	FileStatus status = f->getStatus();
+	if (status != FileStatus::ReadOnly && status != FileStatus::WriteOnly && status != FileStatus::EndOfFile) {
+		return -1;
+	}
+
+	std::lock_guard cursorGuard(f->cursorAccess);
+
+	try {
+		f->mount->refreshClusterTable(); // другой процесс мог дописать этот файл
+
+		int64_t clusterSize = int64_t(f->getClusterSize());
+		size_t length = status == FileStatus::WriteOnly ? f->mount->fileLength(f->getRecordNumber()) : f->fileLength;
+		int64_t position = offset;
+		if (origin == SeekOrigin::Current) {
+			position += int64_t(f->clusterIndex) * clusterSize + int64_t(f->indicatorPosition);
+		}
+		else if (origin == SeekOrigin::End) {
+			position += int64_t(length);
+		}
+		if (position < 0 || size_t(position) > length) {
+			return -1;
+		}
+
+		return moveCursor(f, size_t(position)) ? position : -1;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return -1;
+	}
+}
+
+size_t TestTask::textFS::Tell(File* f) {
+
+	if (!f) {
+		return 0;
+	}
+
+	std::lock_guard cursorGuard(f->cursorAccess);
+	return f->clusterIndex * f->getClusterSize() + f->indicatorPosition;
+}
+
+bool TestTask::textFS::Remove(const char* name) {
+
+	if (!name) {
+		return false;
+	}
+
+	std::string filePath(name);
+
+	try {
+		std::filesystem::path VFSPath = resolveVFS(filePath);
+		if (VFSPath == TestTask::didNotFindVFS) {
+			return false;
+		}
+
+		return mountVFS(VFSPath)->removeFile(filePath);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return false;
+	}
+}
+
+/// <summary>
+/// Изменение длины файла
+/// </summary>
+/// <param name="f"> - File, открытый на запись</param>
+/// <param name="length"> - Новая длина</param>
+/// <returns>false, если длину изменить не удалось</returns>
+bool TestTask::textFS::Truncate(File* f, size_t length) {
+
+	if (!f || f->getStatus() != FileStatus::WriteOnly) {
+		return false;
+	}
+
+	std::lock_guard cursorGuard(f->cursorAccess);
+	std::lock_guard fileGuard(*f->fileAccess);
+	ProcessLockGuard recordGuard(f->mount->processLock, superBlockSize + f->getRecordNumber() * fileRecordSize, fileRecordSize, true);
+
+	try {
+		f->mount->refreshClusterTable();
+		keepInline(f, length); // длиннее записи файл станет только в кластерах
+
+		size_t currentLength = f->mount->fileLength(f->getRecordNumber());
+		if (length > currentLength) { // дописываем нули - дыр в файлах нет
+			std::vector<char> zeros(std::min(length - currentLength, zeroFillChunkSize), 0);
+			while (currentLength < length) {
+				size_t written = writeAt(f, currentLength, zeros.data(), std::min(zeros.size(), length - currentLength));
+				if (!written) {
+					return false;
+				}
+				currentLength += written;
+			}
+			return true;
+		}
+
+		if (length < currentLength && f->mount->truncateFile(f->getRecordNumber(), length)) {
+			std::lock_guard indexGuard(f->indexAccess); // кластеры за новым концом освобождены - индекс их больше не помнит
+			size_t clusterSize = f->getClusterSize();
+			f->chainIndex.resize(std::min(f->chainIndex.size(), std::max<size_t>(1, (length + clusterSize - 1) / clusterSize)));
+		}
+
+		return moveCursor(f, std::min(length, f->clusterIndex * f->getClusterSize() + f->indicatorPosition));
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		return false;
+	}
+}
+
+std::vector<TestTask::DirectoryEntry> TestTask::textFS::ListDirectory(const char* name) {
+
+	std::vector<DirectoryEntry> entries;
+	std::string directoryPath(name && *name ? name : ".");
+
+	try {
+		std::filesystem::path VFSPath = resolveVFS((std::filesystem::path(directoryPath) / "").string());
+		if (VFSPath == TestTask::didNotFindVFS) {
+			return entries;
+		}
+
+		mountVFS(VFSPath)->listDirectory(directoryPath, entries);
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what();
+		entries.clear();
+	}
+	return entries;
+}
@@ -0,0 +1,212 @@
+﻿#include "TestTask.h"
+#include <cstring>
+#include <vector>
+
+void TestTask::putInt32(char* buff, int32_t value) {
+	uint32_t v = uint32_t(value);
+	for (int i = 0; i < 4; ++i) {
+		buff[i] = char((v >> (8 * i)) & 0xFF);
+	}
+}
+
+int32_t TestTask::getInt32(const char* buff) {
+	uint32_t v = 0;
+	for (int i = 0; i < 4; ++i) {
+		v |= uint32_t(uint8_t(buff[i])) << (8 * i);
+	}
+	return int32_t(v);
+}
+
+void TestTask::putInt64(char* buff, int64_t value) {
+	uint64_t v = uint64_t(value);
+	for (int i = 0; i < 8; ++i) {
+		buff[i] = char((v >> (8 * i)) & 0xFF);
+	}
+}
+
+int64_t TestTask::getInt64(const char* buff) {
+	uint64_t v = 0;
+	for (int i = 0; i < 8; ++i) {
+		v |= uint64_t(uint8_t(buff[i])) << (8 * i);
+	}
+	return int64_t(v);
+}
+
+// Расположение полей суперблока
+// 0   magic (4 байта)
+// 4   formatVersion (int32)
+// 8   clusterSize (int64)
+// 16  headerGeneration (int64; в старых VFS здесь мог остаться первый свободный кластер - это лишь начальное значение счетчика)
+// 24  tableGeneration (int64)
+// 32  freeClusters (int64)
+// 40  freeSearchHint (int64)
+// 48  summaryGeneration (int64)
+// 56  cleanShutdown (int32; в старых VFS 0 - сводки нет)
+// 60  блокировка подключений (в файле не хранится)
+// 64  кольцо recentRecordsCount изменений записей: headerGeneration (int64), номер записи (int64) - пишет только writeFileInfo
+
+void TestTask::VFSInfo::serialize(char* buff) const {
+	std::memset(buff, 0, superBlockSize);
+	std::memcpy(buff, VFSMagic, sizeof(VFSMagic));
+	putInt32(buff + 4, int32_t(formatVersion));
+	putInt64(buff + 8, clusterSize);
+	putInt64(buff + headerGenerationOffset, int64_t(headerGeneration));
+	putInt64(buff + tableGenerationOffset, int64_t(tableGeneration));
+	putInt64(buff + 32, freeClusters);
+	putInt64(buff + 40, freeSearchHint);
+	putInt64(buff + 48, int64_t(summaryGeneration));
+	putInt32(buff + 56, cleanShutdown ? 1 : 0);
+}
+
+bool TestTask::VFSInfo::deserialize(const char* buff) {
+	if (std::memcmp(buff, VFSMagic, sizeof(VFSMagic)) != 0) {
+		return false;
+	}
+	formatVersion = uint32_t(getInt32(buff + 4));
+	if (formatVersion < flatDirectoryFormatVersion || formatVersion > VFSFormatVersion) {
+		return false;
+	}
+	clusterSize = getInt64(buff + 8);
+	headerGeneration = uint64_t(getInt64(buff + headerGenerationOffset));
+	tableGeneration = uint64_t(getInt64(buff + tableGenerationOffset));
+	freeClusters = getInt64(buff + 32);
+	freeSearchHint = getInt64(buff + 40);
+	summaryGeneration = uint64_t(getInt64(buff + 48));
+	cleanShutdown = getInt32(buff + 56) != 0;
+	return true;
+}
+
+// Расположение полей записи о файле
+// 0   fileName (maxFileNameLength + 1 байт, дополняется нулями)
+// 256 firstCluster (int64)
+// 264 mode (maxModeMarkLength байт, дополняется нулями)
+// 268 numberOfThreads (int32)
+// 272 parent + 1 (int64, 0 - корень VFS; в версии 2 всегда 0)
+// 280 isDirectory (int32)
+// 284 numberOfReaders (int32)
+// 288 length + 1 (int64, 0 - длина не записана, файл занимает всю свою цепочку кластеров)
+
+void TestTask::FileInfo::serialize(char* buff) const {
+	std::memset(buff, 0, fileRecordSize);
+	std::memcpy(buff, fileName.data(), std::min(fileName.length(), maxFileNameLength));
+	putInt64(buff + 256, firstCluster);
+	std::memcpy(buff + 264, mode.data(), std::min(mode.length(), size_t(maxModeMarkLength)));
+	putInt32(buff + 268, numberOfThreads);
+	putInt64(buff + 272, parent + 1);
+	putInt32(buff + 280, isDirectory ? 1 : 0);
+	putInt32(buff + 284, numberOfReaders);
+	putInt64(buff + fileLengthOffset, length + 1);
+}
+
+void TestTask::FileInfo::deserialize(const char* buff) {
+	fileName.assign(buff, strnlen(buff, maxFileNameLength));
+	firstCluster = getInt64(buff + 256);
+	mode.assign(buff + 264, strnlen(buff + 264, maxModeMarkLength));
+	numberOfThreads = getInt32(buff + 268);
+	parent = getInt64(buff + 272) - 1;
+	isDirectory = getInt32(buff + 280) != 0;
+	numberOfReaders = getInt32(buff + 284);
+	length = getInt64(buff + fileLengthOffset) - 1;
+}
+
+/// <summary>
+/// Проверка, записана ли VFS в старом текстовом формате
+/// </summary>
+/// <param name="VFSPath"> - Путь к папке с VFS</param>
+/// <returns>true, если VFSHeader начинается с текстовых настроек VFS</returns>
+bool TestTask::isTextVFS(const std::filesystem::path& VFSPath) {
+
+	std::ifstream header(VFSPath / VFSHeaderFileName, std::ios::binary);
+	std::string buff;
+	std::getline(header, buff);
+
+	return buff.find(clusterSizeMark) != std::string::npos || buff.find(firstEmptyClusterMark) != std::string::npos;
+}
+
+/// <summary>
+/// Конвертация VFS из текстового формата в бинарный.
+/// Новые файлы пишутся рядом со старыми и заменяют их только после успешной записи
+/// </summary>
+/// <param name="VFSPath"> - Путь к папке с VFS</param>
+void TestTask::convertTextVFS(const std::filesystem::path& VFSPath) {
+
+	std::ifstream oldHeader(VFSPath / VFSHeaderFileName, std::ios::binary);
+	std::ifstream oldTable(VFSPath / VFSTableFileName, std::ios::binary);
+
+	if (!oldHeader || !oldTable) {
+		throw std::runtime_error("Could not open VFS for conversion\n");
+	}
+
+	VFSInfo info;
+	info.formatVersion = flatDirectoryFormatVersion; // записи с полными путями - дерево директорий построится при подключении
+	std::vector<FileInfo> files;
+	std::string buff;
+
+	while (std::getline(oldHeader, buff) && buff.find(endOfVFSInfo) == std::string::npos) { // настройки VFS
+		try {
+			if (buff.find(clusterSizeMark) != std::string::npos) {
+				info.clusterSize = std::stoll(buff.substr(maxSettingLength));
+			}
+		}
+		catch (const std::exception&) {
+			throw std::runtime_error("Error while converting VFS header\n");
+		}
+	}
+
+	// строка о файле: <имя> <16 цифр> <режим, 4 символа> <2 цифры>
+	const size_t fieldsLength = 1 + maxClusterDigits + 1 + maxModeMarkLength + 1 + maxThreadsCounterLength;
+
+	while (std::getline(oldHeader, buff)) {
+		if (buff.length() <= fieldsLength) {
+			continue;
+		}
+		FileInfo file;
+		size_t fields = buff.length() - fieldsLength;
+		file.fileName = buff.substr(0, fields);
+		try {
+			file.firstCluster = std::stoll(buff.substr(fields + 1, maxClusterDigits));
+			file.numberOfThreads = 0; // после конвертации файл никем не открыт
+		}
+		catch (const std::exception&) {
+			file.firstCluster = faultyCluster;
+		}
+		files.push_back(file);
+	}
+
+	std::vector<char> table;
+	while (std::getline(oldTable, buff)) {
+		char entry[tableEntrySize];
+		try {
+			putInt64(entry, std::stoll(buff));
+		}
+		catch (const std::exception&) {
+			putInt64(entry, faultyCluster);
+		}
+		table.insert(table.end(), entry, entry + tableEntrySize);
+	}
+
+	oldHeader.close();
+	oldTable.close();
+
+	std::vector<char> record(std::max(superBlockSize, fileRecordSize));
+	std::ofstream newHeader(VFSPath / (VFSHeaderFileName + ".v2"), std::ios::binary);
+	info.serialize(record.data());
+	newHeader.write(record.data(), superBlockSize);
+	for (const FileInfo& file : files) {
+		file.serialize(record.data());
+		newHeader.write(record.data(), fileRecordSize);
+	}
+	newHeader.close();
+
+	std::ofstream newTable(VFSPath / (VFSTableFileName + ".v2"), std::ios::binary);
+	newTable.write(table.data(), table.size());
+	newTable.close();
+
+	if (!newHeader || !newTable) {
+		throw std::runtime_error("Error while converting VFS\n");
+	}
+
+	std::filesystem::remove(VFSPath / VFSBitmapFileName); // карта свободных кластеров будет построена по новой таблице
+	std::filesystem::rename(VFSPath / (VFSTableFileName + ".v2"), VFSPath / VFSTableFileName);
+	std::filesystem::rename(VFSPath / (VFSHeaderFileName + ".v2"), VFSPath / VFSHeaderFileName); // последним - чтобы isTextVFS оставался true до конца конвертации
+}
@@ -0,0 +1,954 @@
+﻿#include "TestTask.h"
+#include <algorithm>
+#include <iostream>
+
+TestTask::VFSMount::VFSMount(const std::filesystem::path& VFSPath_, StorageBackend backend, size_t cacheSize, size_t compactionRate_, size_t inlineLimit_)
+	: clusterTable(VFSPath_, backend), VFSData(openStorage(VFSPath_ / VFSDataFileName, backend, cacheSize, true)),
+	processLock(VFSPath_ / VFSHeaderFileName), VFSPath(VFSPath_), VFSHeader(openStorage(VFSPath_ / VFSHeaderFileName, backend)),
+	compactionRate(compactionRate_), inlineLimit(std::min(inlineLimit_, maxInlineSize)) {
+
+	// держится, пока VFS подключена: хвост VFSData отрезается, только когда других копий нет.
+	// Первая копия держит ее исключительно до конца подключения - следующие подождут, пока она чинит записи
+	bool alone = processLock.tryLock(mountLockOffset, mountLockSize, true);
+	if (!alone) {
+		processLock.lock(mountLockOffset, mountLockSize, false);
+	}
+
+	ProcessLockGuard headerGuard(processLock, headerGenerationOffset, generationSize, true); // VFS версии 2 перестраивается прямо здесь
+	ProcessLockGuard tableGuard(processLock, tableGenerationOffset, generationSize, true); // журнал VFSTable применяется прямо здесь
+
+	char buff[superBlockSize]; // суперблок целиком читается один раз - при подключении VFS, дальше только счетчики изменений
+
+	if (VFSHeader->read(0, buff, superBlockSize) != superBlockSize || !info.deserialize(buff) || !info) {
+		throw std::runtime_error("Error while working with VFS header\n");
+	}
+
+	FreeSpaceSummary summary{ size_t(std::max<int64_t>(info.freeClusters, 0)), size_t(std::max<int64_t>(info.freeSearchHint, 0)) };
+	bool summaryValid = info.cleanShutdown && info.summaryGeneration == info.tableGeneration; // после чистого отключения таблицу никто не менял
+	clusterTable.recover(summaryValid ? &summary : nullptr, alone && !info.cleanShutdown); // при других подключениях сбоя питания не было
+
+	if (info.cleanShutdown) { // VFS снова в работе: до следующего чистого отключения сводке верить нельзя
+		info.cleanShutdown = false;
+		writeFreeSpaceSummary();
+	}
+
+	loadDirectory();
+
+	if (alone) {
+		resetOpenCounts();
+		processLock.lock(mountLockOffset, mountLockSize, false); // обратно к разделяемой блокировке
+	}
+
+	background = std::thread(&VFSMount::backgroundLoop, this);
+}
+
+TestTask::VFSMount::~VFSMount() {
+	{
+		std::lock_guard checkpointGuard(checkpointAccess);
+		stopping = true;
+	}
+	checkpointWake.notify_all();
+	background.join();
+
+	try {
+		std::lock_guard tableGuard(tableAccess);
+		ProcessLockGuard processGuard(processLock, tableGenerationOffset, generationSize, true);
+
+		refreshTable(); // сводка - по актуальной карте
+		clusterTable.checkpoint();
+
+		FreeSpaceSummary summary = clusterTable.freeSpaceSummary();
+		info.freeClusters = int64_t(summary.freeClusters);
+		info.freeSearchHint = int64_t(summary.searchHint);
+		info.summaryGeneration = info.tableGeneration;
+		info.cleanShutdown = processLock.tryLock(mountLockOffset, mountLockSize, true); // чисто - только если VFS больше никем не подключена
+		writeFreeSpaceSummary();
+		VFSHeader->sync();
+	}
+	catch (const std::exception& e) { // журнал останется на диске и применится при следующем подключении
+		std::cerr << e.what();
+	}
+}
+
+/// <summary>
+/// Поиск начального кластера файла и отметка об открытии File
+/// </summary>
+/// <param name="filePath"> - "Фиктивный" путь к файлу</param>
+/// <param name="mode"> - Режим, в котором будет открыт файл</param>
+/// <param name="create"> - Добавить файл (и недостающие директории) в VFS, если его там нет</param>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <param name="inlineData"> - Куда прочитать данные, если у файла нет кластеров (nullptr - не читать)</param>
+/// <returns>Номер начального кластера файла (didNotFindCluster, если файла нет)</returns>
+int64_t TestTask::VFSMount::openFile(const std::string& filePath, const std::string& mode, bool create, size_t& recordNumber, std::vector<char>* inlineData) {
+
+	std::vector<std::string> components = splitPath(filePath);
+	if (components.empty()) {
+		throw std::runtime_error("Invalid file path\n");
+	}
+
+	std::lock_guard headerGuard(headerAccess);// блокикуем VFSHeader
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, true); // и для других процессов
+
+	refreshHeader();
+	refreshClusterTable(); // открытый файл должен видеть цепочку, дописанную другим процессом
+
+	int64_t directory = findDirectory(components, components.size() - 1, create); // путь до файла - по одному поиску на компонент
+	if (directory == didNotFindRecord) {
+		return didNotFindCluster;
+	}
+
+	std::map<std::string, size_t>& children = directories[directory];
+	auto found = children.find(components.back());
+
+	if (found == children.end()) {
+		if (!create) {
+			return didNotFindCluster; // в том случае, если не нашли файл в VFSHeader
+		}
+		if (components.back().length() > maxFileNameLength) {
+			throw  std::runtime_error("File name is too long\n");
+		}
+
+		int64_t firstCluster = inlineLimit ? int64_t(clusterIsEmpty) : int64_t(allocateChain(endOfFile, 1).front().first); // маленькому файлу кластеры не нужны, пока он не вырастет
+		FileInfo fileInfo(components.back(), firstCluster, mode, 1);
+		fileInfo.parent = directory;
+		fileInfo.length = 0;
+		recordNumber = addRecord(fileInfo);
+		++localWriters[recordNumber];
+		return fileInfo.firstCluster;
+	}
+
+	FileInfo fileInfo = records[found->second];
+
+	if (fileInfo.isDirectory) {
+		throw  std::runtime_error("Trying to open a directory\n");
+	}
+
+	// читатели и писатели друг друга не ждут: читатель видит снимок цепочки на момент открытия
+	if (fileInfo.numberOfThreads + fileInfo.numberOfReaders + 1 > maxThreadsCount) {
+		throw  std::runtime_error("Too many threads for one file\n");
+	}
+	if (mode == WriteOnlyMark) {
+		++fileInfo.numberOfThreads;
+		fileInfo.mode = WriteOnlyMark;
+	}
+	else {
+		++fileInfo.numberOfReaders;
+	}
+	recordNumber = found->second;
+	writeFileInfo(recordNumber, fileInfo); // перед этим увеличилии количество рабочих потоков (см. несколько строк выше)
+
+	if (mode == WriteOnlyMark) {
+		++localWriters[recordNumber];
+	}
+	else if (fileInfo.numberOfThreads > localWriters[recordNumber]) { // файл пишет другой процесс, а запись данных счетчиков не меняет -
+		VFSData->invalidate();                                        // страницы кэша с его кластерами могли устареть
+	}
+
+	if (inlineData && fileInfo.firstCluster < 0) { // перенести файл в кластеры можно только под этой же блокировкой - данные в записи еще его
+		*inlineData = readInline(recordNumber);
+	}
+	return fileInfo.firstCluster;
+}
+
+/// <summary>
+/// Отметка о закрытии File
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <param name="mode"> - Режим, в котором был открыт файл</param>
+void TestTask::VFSMount::closeFile(size_t recordNumber, const std::string& mode) {
+
+	std::lock_guard headerGuard(headerAccess);// блокикуем VFSHeader
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, true);
+
+	refreshHeader();
+
+	if (recordNumber >= records.size()) {
+		return;
+	}
+
+	FileInfo fileInfo = records[recordNumber];
+	if (mode == WriteOnlyMark) {
+		--localWriters[recordNumber];
+		if (!--fileInfo.numberOfThreads) {
+			fileInfo.mode = ReadOnlyMark;
+		}
+	}
+	else {
+		--fileInfo.numberOfReaders;
+	}
+	writeFileInfo(recordNumber, fileInfo);
+}
+
+/// <summary>
+/// Удаление файла или пустой директории. Запись освобождается и сбрасывается на диск раньше кластеров:
+/// при сбое в промежутке кластеры потеряются, но не окажутся сразу в двух файлах
+/// </summary>
+/// <param name="filePath"> - "Фиктивный" путь к файлу</param>
+/// <returns>false, если файла нет, он открыт или это непустая директория</returns>
+bool TestTask::VFSMount::removeFile(const std::string& filePath) {
+
+	std::vector<std::string> components = splitPath(filePath);
+	if (components.empty()) {
+		return false;
+	}
+
+	std::lock_guard headerGuard(headerAccess);
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, true);
+
+	refreshHeader();
+
+	int64_t directory = findDirectory(components, components.size() - 1, false);
+	if (directory == didNotFindRecord) {
+		return false;
+	}
+
+	std::map<std::string, size_t>& children = directories[directory];
+	auto found = children.find(components.back());
+	if (found == children.end()) {
+		return false;
+	}
+
+	size_t recordNumber = found->second;
+	FileInfo fileInfo = records[recordNumber];
+
+	if (fileInfo.numberOfThreads || fileInfo.numberOfReaders) { // File открытого файла ссылаются на его кластеры
+		return false;
+	}
+	if (fileInfo.isDirectory) {
+		auto content = directories.find(int64_t(recordNumber));
+		if (content != directories.end() && !content->second.empty()) {
+			return false;
+		}
+		directories.erase(int64_t(recordNumber));
+	}
+
+	children.erase(found);
+	writeFileInfo(recordNumber, FileInfo(), true);
+	VFSHeader->sync();
+	freeRecords.push_back(recordNumber);
+
+	if (!fileInfo.isDirectory && fileInfo.firstCluster >= 0) {
+		std::lock_guard tableGuard(tableAccess);
+		ProcessLockGuard tableProcessGuard(processLock, tableGenerationOffset, generationSize, true);
+
+		refreshTable();
+		clusterTable.freeRuns(clusterTable.chainRuns(size_t(fileInfo.firstCluster))); // вся цепочка - одна запись журнала
+		clusterTable.flush();
+		writeGeneration(tableGenerationOffset, ++info.tableGeneration);
+
+		if (clusterTable.journalSize() >= journalCheckpointSize) {
+			checkpointWake.notify_one();
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Укорачивание файла (под блокировкой писателей файла). Длина меняется всегда; хвост цепочки освобождается,
+/// только если файл открыт одним этим писателем - иначе его кластеры еще могут читать по снимку
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <param name="length"> - Новая длина (не больше текущей)</param>
+/// <returns>true, если хвост цепочки освобожден</returns>
+bool TestTask::VFSMount::truncateFile(size_t recordNumber, size_t length) {
+
+	std::lock_guard headerGuard(headerAccess); // открытия файла ждут, пока он укорачивается
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, true);
+
+	refreshHeader();
+
+	if (recordNumber >= records.size()) {
+		throw std::runtime_error("Invalid file record\n");
+	}
+	FileInfo fileInfo = records[recordNumber];
+	{
+		std::lock_guard lengthGuard(lengthAccess);
+
+		char buff[8];
+		putInt64(buff, int64_t(length) + 1);
+		VFSHeader->write(superBlockSize + recordNumber * fileRecordSize + fileLengthOffset, buff, sizeof(buff));
+		VFSHeader->sync(); // короткая длина - на диске раньше, чем освободится хвост
+	}
+
+	if (fileInfo.numberOfThreads != 1 || fileInfo.numberOfReaders || fileInfo.firstCluster < 0) {
+		return false;
+	}
+
+	std::lock_guard tableGuard(tableAccess);
+	ProcessLockGuard tableProcessGuard(processLock, tableGenerationOffset, generationSize, true);
+
+	refreshTable();
+	size_t clusterSize = getClusterSize();
+	if (!clusterTable.truncateChain(size_t(fileInfo.firstCluster), std::max<size_t>(1, (length + clusterSize - 1) / clusterSize))) {
+		return false;
+	}
+	clusterTable.flush();
+	writeGeneration(tableGenerationOffset, ++info.tableGeneration);
+	return true;
+}
+
+/// <summary>
+/// Содержимое директории
+/// </summary>
+/// <param name="directoryPath"> - Путь к директории</param>
+/// <param name="entries"> - Куда записать содержимое (в порядке возрастания имен)</param>
+/// <returns>false, если такой директории нет</returns>
+bool TestTask::VFSMount::listDirectory(const std::string& directoryPath, std::vector<DirectoryEntry>& entries) {
+
+	std::vector<std::string> components = splitPath(directoryPath);
+
+	std::lock_guard headerGuard(headerAccess);
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, false);
+
+	refreshHeader();
+
+	int64_t directory = findDirectory(components, components.size(), false);
+	if (directory == didNotFindRecord) {
+		return false;
+	}
+
+	entries.clear();
+	for (const auto& [name, recordNumber] : directories[directory]) {
+		entries.push_back(DirectoryEntry{ name, records[recordNumber].isDirectory });
+	}
+	return true;
+}
+
+/// <summary>
+/// Выделение кластеров. Другие процессы на это время не меняют VFSTable,
+/// а после выделения по счетчику изменений узнают, что свою копию таблицы нужно перечитать
+/// </summary>
+/// <param name="tail"> - Последний кластер файла (отрицательный - новый файл)</param>
+/// <param name="count"> - Количество кластеров</param>
+/// <returns>Выделенные участки в порядке следования в цепочке</returns>
+std::vector<TestTask::Extent> TestTask::VFSMount::allocateChain(int64_t tail, size_t count) {
+
+	std::lock_guard tableGuard(tableAccess);
+	ProcessLockGuard processGuard(processLock, tableGenerationOffset, generationSize, true);
+
+	refreshTable(); // свободные кластеры ищутся по актуальной карте
+
+	std::vector<Extent> extents = clusterTable.allocateChain(tail, count);
+	clusterTable.flush(); // одна запись буфера VFSTable на все выделение, до счетчика изменений
+	VFSData->publish(); // уже записанное в хвост файла другие процессы увидят не позже новой ссылки на него
+	writeGeneration(tableGenerationOffset, ++info.tableGeneration);
+
+	if (clusterTable.journalSize() >= journalCheckpointSize) {
+		checkpointWake.notify_one();
+	}
+	return extents;
+}
+
+void TestTask::VFSMount::refreshClusterTable() {
+
+	std::lock_guard tableGuard(tableAccess);
+	ProcessLockGuard processGuard(processLock, tableGenerationOffset, generationSize, false);
+
+	refreshTable();
+}
+
+std::mutex& TestTask::VFSMount::fileLock(size_t recordNumber) {
+
+	std::lock_guard headerGuard(headerAccess);
+
+	if (recordNumber >= fileLocks.size()) {
+		throw std::runtime_error("Invalid file record\n");
+	}
+	return fileLocks[recordNumber];
+}
+
+/// <summary>
+/// Длина файла. Читается из VFSHeader, а не из записей в памяти: писатели меняют ее,
+/// не трогая счетчик изменений, и кэш записей у других процессов ее не видит
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <returns>Длина файла в байтах</returns>
+size_t TestTask::VFSMount::fileLength(size_t recordNumber) {
+
+	int64_t length = -1;
+	{
+		std::lock_guard lengthGuard(lengthAccess);
+
+		char buff[8];
+		if (VFSHeader->read(superBlockSize + recordNumber * fileRecordSize + fileLengthOffset, buff, sizeof(buff)) != sizeof(buff)) {
+			throw std::runtime_error("Invalid file record\n");
+		}
+		length = getInt64(buff) - 1;
+	}
+
+	if (length < 0) { // длина не записана - видна вся цепочка
+		std::lock_guard headerGuard(headerAccess);
+		return clusterTable.chainLength(size_t(records.at(recordNumber).firstCluster)) * getClusterSize();
+	}
+	return size_t(length);
+}
+
+/// <summary>
+/// Продление файла после записи. Пишутся только 8 байт длины, без счетчика изменений:
+/// остальные поля записи ее не перезаписывают. Данные до новой длины перед этим пишутся из кэша VFSData -
+/// иначе другой процесс прочитает на их месте старое содержимое кластеров
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <param name="end"> - Конец записанных данных</param>
+/// <returns>Длина файла после продления</returns>
+size_t TestTask::VFSMount::extendFileLength(size_t recordNumber, size_t end) {
+
+	size_t length = fileLength(recordNumber);
+	if (end <= length) {
+		return length;
+	}
+
+	VFSData->publish();
+
+	std::lock_guard lengthGuard(lengthAccess);
+
+	char buff[8];
+	putInt64(buff, int64_t(end) + 1);
+	VFSHeader->write(superBlockSize + recordNumber * fileRecordSize + fileLengthOffset, buff, sizeof(buff));
+	VFSHeader->flush();
+	return end;
+}
+
+int64_t TestTask::VFSMount::firstCluster(size_t recordNumber) {
+
+	std::lock_guard headerGuard(headerAccess);
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, false);
+
+	refreshHeader();
+	return records.at(recordNumber).firstCluster;
+}
+
+/// <summary>
+/// Данные файла без кластеров. Длина и данные лежат в записи подряд - это одно чтение VFSHeader
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <returns>Данные файла</returns>
+std::vector<char> TestTask::VFSMount::readInline(size_t recordNumber) {
+
+	std::lock_guard lengthGuard(lengthAccess);
+
+	char buff[fileRecordSize - fileLengthOffset];
+	if (VFSHeader->read(superBlockSize + recordNumber * fileRecordSize + fileLengthOffset, buff, sizeof(buff)) != sizeof(buff)) {
+		throw std::runtime_error("Invalid file record\n");
+	}
+
+	size_t length = size_t(std::clamp<int64_t>(getInt64(buff) - 1, 0, int64_t(maxInlineSize))); // длиннее записи данные быть не могут
+	const char* data = buff + (inlineDataOffset - fileLengthOffset);
+	return std::vector<char>(data, data + length);
+}
+
+void TestTask::VFSMount::writeInline(size_t recordNumber, size_t offset, const char* buff, size_t len) {
+
+	if (offset + len > maxInlineSize) {
+		throw std::runtime_error("File does not fit into its record\n");
+	}
+	VFSHeader->write(superBlockSize + recordNumber * fileRecordSize + inlineDataOffset + offset, buff, len); // видимой запись сделает extendFileLength
+}
+
+/// <summary>
+/// Перенос данных файла из записи в кластеры, когда файл перестал в нее помещаться. Данные в записи остаются:
+/// читатели, открывшие файл раньше, читают свой снимок
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <returns>Первый кластер файла</returns>
+int64_t TestTask::VFSMount::promoteFile(size_t recordNumber) {
+
+	std::lock_guard headerGuard(headerAccess);
+	ProcessLockGuard processGuard(processLock, headerGenerationOffset, generationSize, true);
+
+	refreshHeader();
+
+	FileInfo fileInfo = records.at(recordNumber);
+	if (fileInfo.firstCluster >= 0) { // уже перенес другой писатель
+		return fileInfo.firstCluster;
+	}
+
+	std::vector<char> data = readInline(recordNumber);
+	size_t clusterSize = getClusterSize();
+	size_t written = 0;
+
+	std::vector<Extent> extents = allocateChain(endOfFile, std::max<size_t>(1, (data.size() + clusterSize - 1) / clusterSize));
+	for (const Extent& extent : extents) {
+		size_t textLength = std::min(extent.length * clusterSize, data.size() - written);
+		if (textLength) {
+			VFSData->write(extent.first * clusterSize, data.data() + written, textLength);
+		}
+		written += textLength;
+	}
+	VFSData->sync(); // данные - в кластерах раньше, чем на них сошлется запись: другой процесс читает их мимо нашего кэша
+
+	fileInfo.firstCluster = int64_t(extents.front().first);
+	writeFileInfo(recordNumber, fileInfo);
+	return fileInfo.firstCluster;
+}
+
+void TestTask::VFSMount::sync() {
+	VFSData->sync();
+	clusterTable.sync();
+	std::lock_guard headerGuard(headerAccess);
+	VFSHeader->sync();
+}
+
+void TestTask::VFSMount::checkpoint() {
+
+	std::lock_guard tableGuard(tableAccess);
+	ProcessLockGuard processGuard(processLock, tableGenerationOffset, generationSize, true); // другие процессы в это время журнал не дописывают
+
+	clusterTable.checkpoint();
+}
+
+/// <summary>
+/// Шаг уплотнения VFSData: перенос одного закрытого файла. Записи просматриваются по кругу, с того места,
+/// где остановился прошлый шаг; если переносить нечего - отрезается свободный хвост
+/// </summary>
+/// <param name="maxBytes"> - Файлы больше этого не переносятся</param>
+/// <returns>Сколько байт перенесено</returns>
+size_t TestTask::VFSMount::compactStep(size_t maxBytes) {
+
+	std::lock_guard headerGuard(headerAccess); // файл не откроют, пока его кластеры переносятся
+	ProcessLockGuard headerProcessGuard(processLock, headerGenerationOffset, generationSize, true);
+	std::lock_guard tableGuard(tableAccess);
+	ProcessLockGuard tableProcessGuard(processLock, tableGenerationOffset, generationSize, true);
+
+	refreshHeader();
+	refreshTable();
+
+	for (size_t examined = 0; examined < std::min(records.size(), compactionRecordsPerStep); ++examined) {
+		compactionCursor = compactionCursor + 1 < records.size() ? compactionCursor + 1 : 0;
+
+		size_t moved = moveFile(compactionCursor, maxBytes);
+		if (moved) {
+			return moved;
+		}
+	}
+
+	trimData();
+	return 0;
+}
+
+/// <summary>
+/// Перенос цепочки закрытого файла в один непрерывный участок. Раздробленный файл переносится куда угодно,
+/// непрерывный - только ближе к началу VFSData. Порядок такой, что при сбое на любом шаге запись о файле
+/// ссылается на целую цепочку, а худшее последствие - потерянные кластеры
+/// </summary>
+/// <param name="recordNumber"> - Номер записи о файле</param>
+/// <param name="maxBytes"> - Файлы больше этого не переносятся</param>
+/// <returns>Сколько байт перенесено (0 - файл остался на месте)</returns>
+size_t TestTask::VFSMount::moveFile(size_t recordNumber, size_t maxBytes) {
+
+	FileInfo fileInfo = records[recordNumber];
+	if (fileInfo.isDirectory || fileInfo.firstCluster < 0 || fileInfo.numberOfThreads || fileInfo.numberOfReaders) { // File открытого файла помнят номера кластеров
+		return 0;
+	}
+
+	std::vector<Extent> runs = clusterTable.chainRuns(size_t(fileInfo.firstCluster));
+	size_t clusters = 0;
+	for (const Extent& run : runs) {
+		clusters += run.length;
+	}
+
+	size_t clusterSize = getClusterSize();
+	if (runs.empty() || clusters * clusterSize > maxBytes) {
+		return 0;
+	}
+
+	Extent target = clusterTable.reserveRun(clusters, runs.size() > 1 ? SIZE_MAX : runs.front().first);
+	if (!target.length) {
+		return 0;
+	}
+
+	std::vector<char> buff(std::min(clusters * clusterSize, compactionBufferSize));
+	size_t destination = target.first * clusterSize;
+	for (const Extent& run : runs) {
+		for (size_t source = run.first * clusterSize; source < (run.first + run.length) * clusterSize;) {
+			size_t chunk = std::min(buff.size(), (run.first + run.length) * clusterSize - source);
+			size_t readBytes = VFSData->read(source, buff.data(), chunk);
+			std::fill(buff.begin() + readBytes, buff.begin() + chunk, 0); // за концом VFSData - нули, а не то, что лежало на новом месте
+			VFSData->write(destination, buff.data(), chunk);
+			source += chunk;
+			destination += chunk;
+		}
+	}
+	VFSData->sync(); // данные на новом месте - на диске раньше, чем на них сошлется запись о файле
+
+	clusterTable.linkRun(target);
+	fileInfo.firstCluster = int64_t(target.first);
+	writeFileInfo(recordNumber, fileInfo);
+	VFSHeader->sync(); // старая цепочка освобождается, только когда на нее больше не ссылается запись на диске
+
+	clusterTable.freeRuns(runs);
+	clusterTable.flush();
+	writeGeneration(tableGenerationOffset, ++info.tableGeneration);
+
+	if (clusterTable.journalSize() >= journalCheckpointSize) {
+		checkpointWake.notify_one();
+	}
+	return clusters * clusterSize;
+}
+
+/// <summary>
+/// Отрезание свободного хвоста VFSTable, карты и VFSData. Другие подключившие VFS копии могли бы
+/// обратиться за новый конец (отображение, кэш страниц), поэтому хвост отрезается, только если их нет
+/// </summary>
+void TestTask::VFSMount::trimData() {
+
+	if (!processLock.tryLock(mountLockOffset, mountLockSize, true)) {
+		return;
+	}
+
+	try {
+		size_t clusters = clusterTable.size();
+		size_t remaining = clusterTable.trimFreeTail();
+
+		if (remaining != clusters) {
+			writeGeneration(tableGenerationOffset, ++info.tableGeneration);
+		}
+		if (VFSData->size() > remaining * getClusterSize()) {
+			VFSData->truncate(remaining * getClusterSize());
+		}
+	}
+	catch (const std::exception&) {
+		processLock.lock(mountLockOffset, mountLockSize, false);
+		throw;
+	}
+	processLock.lock(mountLockOffset, mountLockSize, false); // обратно к разделяемой блокировке
+}
+
+void TestTask::VFSMount::backgroundLoop() {
+
+	std::unique_lock checkpointGuard(checkpointAccess);
+	std::chrono::steady_clock::time_point nextCompaction = std::chrono::steady_clock::now();
+
+	while (!stopping) {
+		checkpointWake.wait_for(checkpointGuard, journalCheckpointInterval);
+		if (stopping) {
+			break;
+		}
+
+		checkpointGuard.unlock();
+		try {
+			if (clusterTable.journalSize()) { // пустой журнал - блокировку VFSTable не берем
+				checkpoint();
+			}
+			// шаги идут, пока перенесенное укладывается в заданную скорость; неизрасходованное копится не дольше одного интервала
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			nextCompaction = std::max(nextCompaction, now - journalCheckpointInterval);
+			while (compactionRate && nextCompaction <= now) {
+				size_t moved = compactStep(compactionMaxFileBytes);
+				if (!moved) { // переносить нечего - до следующего пробуждения
+					nextCompaction = now + journalCheckpointInterval;
+					break;
+				}
+				nextCompaction += std::chrono::microseconds(moved * 1000000 / compactionRate);
+			}
+		}
+		catch (const std::exception& e) {
+			std::cerr << e.what();
+		}
+		checkpointGuard.lock();
+	}
+}
+
+void TestTask::VFSMount::refreshHeader() {
+
+	uint64_t generation = readGeneration(headerGenerationOffset);
+	if (generation != info.headerGeneration) {
+		if (!reloadChangedRecords(generation)) {
+			loadDirectory();
+		}
+		VFSData->invalidate(); // другой процесс открывал или закрывал файлы - мог и записать данные
+		info.headerGeneration = generation;
+	}
+}
+
+/// <summary>
+/// Перечитывание записей, измененных другими процессами, по кольцу последних изменений в суперблоке.
+/// Open и Close меняют только счетчики открытых File - дерево директорий при этом не перестраивается
+/// </summary>
+/// <param name="generation"> - headerGeneration на диске</param>
+/// <returns>false, если кольцо уже не помнит всех изменений или запись появилась, исчезла либо переехала</returns>
+bool TestTask::VFSMount::reloadChangedRecords(uint64_t generation) {
+
+	if (generation < info.headerGeneration || generation - info.headerGeneration > recentRecordsCount) {
+		return false;
+	}
+
+	char ring[recentRecordsCount * recentRecordSize];
+	if (VFSHeader->read(recentRecordsOffset, ring, sizeof(ring)) != sizeof(ring)) {
+		return false;
+	}
+
+	for (uint64_t changeGeneration = info.headerGeneration + 1; changeGeneration <= generation; ++changeGeneration) {
+		const char* change = ring + changeGeneration % recentRecordsCount * recentRecordSize;
+		int64_t recordNumber = getInt64(change + 8);
+		if (uint64_t(getInt64(change)) != changeGeneration || recordNumber < 0 || size_t(recordNumber) >= records.size()) {
+			return false; // изменение записала старая версия или суперблок переписан целиком
+		}
+
+		char buff[fileRecordSize];
+		if (VFSHeader->read(superBlockSize + size_t(recordNumber) * fileRecordSize, buff, fileRecordSize) != fileRecordSize) {
+			return false;
+		}
+		FileInfo fileInfo;
+		fileInfo.deserialize(buff);
+
+		const FileInfo& known = records[size_t(recordNumber)];
+		if (fileInfo.fileName != known.fileName || fileInfo.parent != known.parent || fileInfo.isDirectory != known.isDirectory) {
+			return false;
+		}
+		records[size_t(recordNumber)] = fileInfo;
+	}
+	return true;
+}
+
+void TestTask::VFSMount::refreshTable() {
+
+	uint64_t generation = readGeneration(tableGenerationOffset);
+	if (generation != info.tableGeneration) {
+		clusterTable.reload();
+		VFSData->invalidate();
+		info.tableGeneration = generation;
+	}
+}
+
+uint64_t TestTask::VFSMount::readGeneration(size_t offset) {
+
+	char buff[generationSize];
+	if (VFSHeader->read(offset, buff, generationSize) != generationSize) {
+		throw std::runtime_error("Error while working with VFS header\n");
+	}
+	return uint64_t(getInt64(buff));
+}
+
+void TestTask::VFSMount::writeGeneration(size_t offset, uint64_t generation) {
+
+	char buff[generationSize];
+	putInt64(buff, int64_t(generation));
+
+	VFSHeader->write(offset, buff, generationSize);
+	VFSHeader->flush();
+}
+
+/// <summary>
+/// Разбиение пути на компоненты. Путь может быть записан как от текущей папки (как в Open и Create),
+/// так и от корня VFS
+/// </summary>
+/// <param name="path"> - Путь</param>
+/// <returns>Имена директорий от корня VFS и имя последнего компонента</returns>
+std::vector<std::string> TestTask::VFSMount::splitPath(const std::string& path) {
+
+	std::filesystem::path normalPath = std::filesystem::path(path).lexically_normal();
+	std::filesystem::path root = VFSPath.lexically_normal();
+
+	if (!root.empty() && root != ".") {
+		std::filesystem::path relative = normalPath.lexically_relative(root);
+		if (!relative.empty() && *relative.begin() != "..") {
+			normalPath = relative;
+		}
+	}
+
+	std::vector<std::string> components;
+	for (const std::filesystem::path& component : normalPath.relative_path()) {
+		std::string name = component.string();
+		if (name.empty() || name == ".") {
+			continue;
+		}
+		if (name == "..") {
+			throw std::runtime_error("Path leads outside of VFS\n");
+		}
+		components.push_back(name);
+	}
+	return components;
+}
+
+/// <summary>
+/// Поиск директории по пути (VFSHeader уже заблокирован)
+/// </summary>
+/// <param name="components"> - Компоненты пути</param>
+/// <param name="depth"> - Сколько первых компонентов составляют путь к директории</param>
+/// <param name="create"> - Создавать недостающие директории</param>
+/// <returns>Номер записи директории (rootDirectory для корня, didNotFindRecord, если директории нет)</returns>
+int64_t TestTask::VFSMount::findDirectory(const std::vector<std::string>& components, size_t depth, bool create) {
+
+	int64_t directory = rootDirectory;
+
+	for (size_t i = 0; i < depth; ++i) {
+		std::map<std::string, size_t>& children = directories[directory];
+		auto found = children.find(components[i]);
+
+		if (found == children.end()) {
+			if (!create) {
+				return didNotFindRecord;
+			}
+			if (components[i].length() > maxFileNameLength) {
+				throw  std::runtime_error("Directory name is too long\n");
+			}
+			FileInfo directoryInfo;
+			directoryInfo.fileName = components[i];
+			directoryInfo.parent = directory;
+			directoryInfo.isDirectory = true;
+			directory = int64_t(addRecord(directoryInfo));
+		}
+		else if (!records[found->second].isDirectory) {
+			throw  std::runtime_error(components[i] + " is not a directory\n");
+		}
+		else {
+			directory = int64_t(found->second);
+		}
+	}
+	return directory;
+}
+
+/// <summary>
+/// Добавление записи на место удаленной или в конец VFSHeader и в индекс родительской директории
+/// </summary>
+/// <param name="fileInfo"> - Запись</param>
+/// <returns>Номер новой записи</returns>
+size_t TestTask::VFSMount::addRecord(const FileInfo& fileInfo) {
+
+	size_t recordNumber = records.size();
+	if (!freeRecords.empty()) {
+		recordNumber = freeRecords.back();
+		freeRecords.pop_back();
+	}
+	writeFileInfo(recordNumber, fileInfo, true);
+
+	directories[fileInfo.parent][fileInfo.fileName] = recordNumber;
+	if (fileInfo.isDirectory) {
+		directories[int64_t(recordNumber)];
+	}
+	return recordNumber;
+}
+
+/// <summary>
+/// Сброс счетчиков открытых File, когда других подключений нет. Процесс, завершившийся без Close,
+/// оставляет их в записях: иначе такой файл нельзя было бы удалить, укоротить или перенести
+/// (обе блокировки взяты, записи загружены)
+/// </summary>
+void TestTask::VFSMount::resetOpenCounts() {
+
+	for (size_t recordNumber = 0; recordNumber < records.size(); ++recordNumber) {
+		FileInfo fileInfo = records[recordNumber];
+		if (fileInfo.numberOfThreads || fileInfo.numberOfReaders) {
+			fileInfo.numberOfThreads = 0;
+			fileInfo.numberOfReaders = 0;
+			fileInfo.mode = ReadOnlyMark;
+			writeFileInfo(recordNumber, fileInfo);
+		}
+	}
+}
+
+/// <summary>
+/// Чтение всех записей из VFSHeader (одним чтением) и построение дерева директорий
+/// </summary>
+void TestTask::VFSMount::loadDirectory() {
+
+	size_t headerSize = VFSHeader->size();
+	size_t recordCount = headerSize > superBlockSize ? (headerSize - superBlockSize) / fileRecordSize : 0;
+
+	std::vector<char> buff(recordCount * fileRecordSize);
+	recordCount = VFSHeader->read(superBlockSize, buff.data(), buff.size()) / fileRecordSize;
+
+	records.resize(recordCount);
+	while (fileLocks.size() < recordCount) {
+		fileLocks.emplace_back();
+	}
+	localWriters.resize(std::max(localWriters.size(), recordCount), 0);
+	directories.clear();
+	directories[rootDirectory];
+	freeRecords.clear();
+
+	for (size_t recordNumber = 0; recordNumber < recordCount; ++recordNumber) {
+		records[recordNumber].deserialize(buff.data() + recordNumber * fileRecordSize);
+	}
+
+	if (info.formatVersion <= flatDirectoryFormatVersion) {
+		upgradeFlatDirectory();
+		return;
+	}
+
+	for (size_t recordNumber = 0; recordNumber < recordCount; ++recordNumber) {
+		const FileInfo& fileInfo = records[recordNumber];
+		if (fileInfo.fileName.empty()) {
+			freeRecords.push_back(recordNumber);
+			continue;
+		}
+		directories[fileInfo.parent][fileInfo.fileName] = recordNumber;
+		if (fileInfo.isDirectory) {
+			directories[int64_t(recordNumber)];
+		}
+	}
+}
+
+/// <summary>
+/// Перестройка VFS версии 2: записи о файлах остаются на своих местах, но хранят только имя,
+/// а директории из их путей добавляются в конец VFSHeader
+/// </summary>
+void TestTask::VFSMount::upgradeFlatDirectory() {
+
+	size_t flatCount = records.size();
+
+	for (size_t recordNumber = 0; recordNumber < flatCount; ++recordNumber) {
+		FileInfo fileInfo = records[recordNumber];
+		std::vector<std::string> components = splitPath(fileInfo.fileName);
+		if (components.empty()) {
+			continue;
+		}
+
+		fileInfo.parent = findDirectory(components, components.size() - 1, true);
+		fileInfo.fileName = components.back();
+		writeFileInfo(recordNumber, fileInfo);
+		directories[fileInfo.parent][fileInfo.fileName] = recordNumber;
+	}
+
+	info.formatVersion = VFSFormatVersion;
+	writeSuperBlock();
+}
+
+/// <summary>
+/// Запись записи о файле в VFSHeader
+/// </summary>
+/// <param name="recordNumber"> - Номер записи</param>
+/// <param name="fileInfo"> - Что записать</param>
+/// <param name="withLength"> - Записать и длину (запись занимает новый файл)</param>
+void TestTask::VFSMount::writeFileInfo(size_t recordNumber, const FileInfo& fileInfo, bool withLength) {
+
+	char buff[fileRecordSize];
+	fileInfo.serialize(buff);
+
+	bool wholeRecord = withLength || recordNumber >= records.size();
+	VFSHeader->write(superBlockSize + recordNumber * fileRecordSize, buff, wholeRecord ? fileRecordSize : fileLengthOffset); // длину открытого файла меняют только extendFileLength и truncateFile
+	VFSHeader->flush();
+	char change[recentRecordSize];
+	putInt64(change, int64_t(++info.headerGeneration));
+	putInt64(change + 8, int64_t(recordNumber));
+	VFSHeader->write(recentRecordsOffset + info.headerGeneration % recentRecordsCount * recentRecordSize, change, recentRecordSize);
+	writeGeneration(headerGenerationOffset, info.headerGeneration); // другие процессы перечитают эту запись
+
+	if (recordNumber >= records.size()) {
+		records.resize(recordNumber + 1);
+	}
+	while (fileLocks.size() < records.size()) {
+		fileLocks.emplace_back();
+	}
+	localWriters.resize(std::max(localWriters.size(), records.size()), 0);
+	records[recordNumber] = fileInfo;
+}
+
+void TestTask::VFSMount::writeFreeSpaceSummary() {
+
+	char buff[superBlockSize];
+	info.serialize(buff);
+
+	VFSHeader->write(freeSpaceSummaryOffset, buff + freeSpaceSummaryOffset, freeSpaceSummarySize); // счетчики изменений не трогаем
+	VFSHeader->flush();
+}
+
+void TestTask::VFSMount::writeSuperBlock() {
+
+	char buff[superBlockSize];
+	info.serialize(buff);
+
+	VFSHeader->write(0, buff, superBlockSize);
+	VFSHeader->flush();
+}